@@ -0,0 +1,110 @@
+// Compares anti-aliasing with a multisampled FBO, resolved by glBlitFramebuffer(),
+// against supersampling: rendering at a multiple of the size and downscaling on the CPU.
+
+#include <benchmark/benchmark.h>
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "bench_context.h"
+#include "system-gl.h"
+#include "FBO.h"
+#include "PixelBuffer.h"
+#include "render_modern_ogl3.h"
+
+namespace {
+
+// Averages factor x factor blocks of RGBA pixels
+void downsampleBox(const uint8_t *src, int width, int height, int factor, uint8_t *dst)
+{
+  const int outWidth = width / factor;
+  const int outHeight = height / factor;
+  const unsigned int count = factor * factor;
+  std::vector<unsigned int> sums(4 * outWidth);
+  for (int y = 0; y < outHeight; ++y) {
+    std::fill(sums.begin(), sums.end(), 0);
+    for (int sy = 0; sy < factor; ++sy) {
+      const uint8_t *row = src + 4 * (static_cast<size_t>(y * factor + sy) * width);
+      for (int x = 0; x < outWidth * factor; ++x) {
+        for (int c = 0; c < 4; ++c) sums[4 * (x / factor) + c] += row[4 * x + c];
+      }
+    }
+    uint8_t *out = dst + 4 * static_cast<size_t>(y) * outWidth;
+    for (int i = 0; i < 4 * outWidth; ++i) out[i] = (sums[i] + count / 2) / count;
+  }
+}
+
+// samples > 0: MSAA with that many samples. factor > 1: supersampling by that factor in each direction.
+void BM_Antialias(benchmark::State& state, const std::string& provider, int samples, int factor)
+{
+  const int size = state.range(0);
+  const int renderSize = size * factor;
+  auto ctx = createBenchContext(provider, renderSize, renderSize);
+  if (!ctx) {
+    state.SkipWithError(("Unable to create " + provider + " context").c_str());
+    return;
+  }
+  auto fbo = createFBO(*ctx, samples);
+  auto resolveFbo = samples > 0 ? createBlitFBO(*ctx) : nullptr;
+  if (!fbo || (samples > 0 && !resolveFbo)) {
+    state.SkipWithError("Unable to create FBO");
+    return;
+  }
+  if (resolveFbo) resolveFbo->unbind();
+  state.SetLabel(std::to_string(samples > 0 ? fbo->samples() : factor * factor) + " samples per pixel");
+
+  std::vector<MyState> states;
+  ProgramRegistry programs;
+  std::ostringstream setupLog;
+  auto *coutBuffer = std::cout.rdbuf(setupLog.rdbuf());
+  setupModernOGL3(states, "330", programs);
+  std::cout.rdbuf(coutBuffer);
+  glViewport(0, 0, renderSize, renderSize);
+
+  PixelBuffer rendered, buffer;
+  rendered.resize(4 * static_cast<size_t>(renderSize) * renderSize);
+  buffer.resize(4 * static_cast<size_t>(size) * size);
+  for (auto _ : state) {
+    renderModernOGL3(states);
+    if (resolveFbo) fbo->blitTo(*resolveFbo, size, size, /*flipY*/ false);
+    if (factor > 1) {
+      glReadPixels(0, 0, renderSize, renderSize, GL_RGBA, GL_UNSIGNED_BYTE, rendered.data());
+      downsampleBox(rendered.data(), renderSize, renderSize, factor, buffer.data());
+    } else {
+      glReadPixels(0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, buffer.data());
+    }
+    benchmark::DoNotOptimize(buffer.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+int registerAntialiasBenchmarks()
+{
+  struct Mode {
+    const char *name;
+    int samples;
+    int factor;
+  };
+  const Mode modes[] = {
+    {"None", 0, 1},
+    {"MSAA2", 2, 1},
+    {"MSAA4", 4, 1},
+    {"MSAA8", 8, 1},
+    {"SSAA2x2", 0, 2},
+    {"SSAA3x3", 0, 3},
+  };
+  for (const auto& provider : benchProviders()) {
+    for (const auto& mode : modes) {
+      benchmark::RegisterBenchmark(("BM_Antialias/" + provider + "/" + mode.name).c_str(), BM_Antialias,
+                                   provider, mode.samples, mode.factor)
+        ->Arg(256)->Arg(512)->Arg(1024)->Unit(benchmark::kMillisecond);
+    }
+  }
+  return 0;
+}
+
+const int antialiasBenchmarks = registerAntialiasBenchmarks();
+
+} // namespace
@@ -0,0 +1,91 @@
+// Per-image cost of rendering small images one at a time, each with its own readback,
+// against packing them into the cells of an atlas read back at once (--batch).
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "bench_context.h"
+#include "system-gl.h"
+#include "atlas_batch.h"
+#include "FBO.h"
+#include "FrameSink.h"
+#include "PixelBuffer.h"
+#include "render_modern_ogl3.h"
+
+namespace {
+
+const int cellSize = 256;
+const int imagesPerIteration = 64;
+
+// Drops frames, reusing a single buffer
+class NullSink : public FrameSink
+{
+  PixelBuffer buffer;
+
+public:
+  PixelBuffer& acquireBuffer() override { return this->buffer; }
+  bool submitFrame(PixelBuffer& buffer) override {
+    benchmark::DoNotOptimize(buffer.data());
+    return true;
+  }
+  bool finish() override { return true; }
+};
+
+// atlasSize 0 renders and reads back every image on its own
+void BM_Thumbnails(benchmark::State& state, const std::string& provider)
+{
+  const int atlasSize = state.range(0);
+  const AtlasLayout layout = atlasLayout(cellSize, cellSize, imagesPerIteration, std::max(atlasSize, cellSize));
+  auto ctx = createBenchContext(provider, layout.width(), layout.height());
+  if (!ctx) {
+    state.SkipWithError(("Unable to create " + provider + " context").c_str());
+    return;
+  }
+  auto fbo = createFBO(*ctx);
+  if (!fbo) {
+    state.SkipWithError("Unable to create FBO");
+    return;
+  }
+  state.SetLabel(atlasSize > 0 ? std::to_string(layout.numCells()) + " cells per atlas" : "one image per readback");
+
+  std::vector<MyState> states;
+  ProgramRegistry programs;
+  std::ostringstream setupLog;
+  auto *coutBuffer = std::cout.rdbuf(setupLog.rdbuf());
+  setupModernOGL3(states, "330", programs);
+  std::cout.rdbuf(coutBuffer);
+  const auto render = [&states]() { renderModernOGL3(states); };
+
+  NullSink sink;
+  for (auto _ : state) {
+    if (atlasSize > 0) {
+      renderAtlasBatch(*ctx, layout, imagesPerIteration, render, []() {}, sink);
+    } else {
+      for (int i = 0; i < imagesPerIteration; ++i) {
+        render();
+        auto& buffer = sink.acquireBuffer();
+        ctx->getFramebuffer(buffer);
+        sink.submitFrame(buffer);
+      }
+    }
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * imagesPerIteration);
+}
+
+int registerAtlasBenchmarks()
+{
+  for (const auto& provider : benchProviders()) {
+    benchmark::RegisterBenchmark(("BM_Thumbnails/" + provider).c_str(), BM_Thumbnails, provider)
+      ->Arg(0)->Arg(512)->Arg(1024)->Arg(2048)->Unit(benchmark::kMillisecond);
+  }
+  return 0;
+}
+
+const int atlasBenchmarks = registerAtlasBenchmarks();
+
+} // namespace
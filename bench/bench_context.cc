@@ -0,0 +1,63 @@
+#include "bench_context.h"
+
+#include <cstdio>
+#include <iostream>
+
+#include "system-gl.h"
+#include "OffscreenContext.h"
+#include "OffscreenContextFactory.h"
+
+std::vector<std::string> benchProviders()
+{
+  std::vector<std::string> providers;
+#ifdef HAS_EGL
+  providers.push_back("egl");
+#endif
+#ifdef ENABLE_GLX
+  providers.push_back("glx");
+#endif
+#ifdef __APPLE__
+  providers.push_back("cgl");
+#endif
+#ifdef _WIN32
+  providers.push_back("wgl");
+#endif
+  return providers;
+}
+
+std::shared_ptr<OpenGLContext> createBenchContext(const std::string& provider, int width, int height,
+                                                  unsigned int major, unsigned int minor, bool gles)
+{
+  OffscreenContextFactory::ContextAttributes attrib = {
+    .width = static_cast<unsigned int>(width),
+    .height = static_cast<unsigned int>(height),
+    .majorGLVersion = major,
+    .minorGLVersion = minor,
+    .gles = gles,
+    .compatibilityProfile = false,
+    .gpu = "",
+    .invisible = true,
+  };
+  auto created = OffscreenContextFactory::create(provider, attrib);
+  if (!created) return nullptr;
+  // Contexts aren't destroyed with their last reference, so do that here rather than in every benchmark
+  std::shared_ptr<OpenGLContext> ctx(created.get(), [created](OpenGLContext *) {
+    if (const auto offscreen = std::dynamic_pointer_cast<OffscreenContext>(created)) offscreen->destroy();
+  });
+  if (!ctx->makeCurrent()) return nullptr;
+
+#ifdef USE_GLAD
+  if ((gles ? gladLoaderLoadGLES2() : gladLoaderLoadGL()) == 0) return nullptr;
+#endif
+  const char *versionString = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+  if (!versionString) return nullptr;
+  std::string glVersion = versionString;
+  if (gles && glVersion.rfind("OpenGL ES ", 0) == 0) glVersion = glVersion.substr(10);
+  int glMajor, glMinor;
+  if (sscanf(glVersion.c_str(), "%d.%d", &glMajor, &glMinor) != 2) return nullptr;
+  ctx->setVersion(glMajor, glMinor, gles);
+#ifndef USE_GLAD
+  initGLExtensions(glMajor, glMinor, gles);
+#endif
+  return ctx;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "OpenGLContext.h"
+
+// Context providers compiled into this build, headless ones first
+std::vector<std::string> benchProviders();
+
+// Creates an offscreen context, makes it current and loads GL functions, like main() does.
+// The context is destroyed with the last reference to it. Returns nullptr if the provider or version
+// isn't available.
+std::shared_ptr<OpenGLContext> createBenchContext(const std::string& provider, int width, int height,
+                                                  unsigned int major = 3, unsigned int minor = 3,
+                                                  bool gles = false);
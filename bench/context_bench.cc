@@ -0,0 +1,103 @@
+// Startup costs: creating a context on each provider, and creating or resizing its FBO.
+
+#include <benchmark/benchmark.h>
+
+#include "bench_context.h"
+#include "system-gl.h"
+#include "FBO.h"
+
+namespace {
+
+// Includes making the context current and loading GL functions. Destroying it again isn't timed, but
+// happens every iteration so later ones don't run with all earlier contexts alive.
+void BM_ContextCreation(benchmark::State& state, const std::string& provider, unsigned int major,
+                        unsigned int minor, bool gles)
+{
+  for (auto _ : state) {
+    auto ctx = createBenchContext(provider, 512, 512, major, minor, gles);
+    if (!ctx) {
+      state.SkipWithError(("Unable to create " + provider + " context").c_str());
+      return;
+    }
+    state.PauseTiming();
+    ctx.reset();  // Destroys the context, see createBenchContext()
+    state.ResumeTiming();
+  }
+}
+
+// Creates and destroys an FBO, finishing so lazily allocated storage is counted too
+void BM_CreateFBO(benchmark::State& state, const std::string& provider)
+{
+  const int size = state.range(0);
+  auto ctx = createBenchContext(provider, size, size);
+  if (!ctx) {
+    state.SkipWithError(("Unable to create " + provider + " context").c_str());
+    return;
+  }
+  for (auto _ : state) {
+    auto fbo = createFBO(*ctx);
+    if (!fbo) {
+      state.SkipWithError("Unable to create FBO");
+      return;
+    }
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glFinish();
+  }
+}
+
+// Alternates between the full and half size, one resize per iteration
+void BM_ResizeFBO(benchmark::State& state, const std::string& provider)
+{
+  const int size = state.range(0);
+  auto ctx = createBenchContext(provider, size, size);
+  if (!ctx) {
+    state.SkipWithError(("Unable to create " + provider + " context").c_str());
+    return;
+  }
+  auto fbo = createFBO(*ctx);
+  if (!fbo) {
+    state.SkipWithError("Unable to create FBO");
+    return;
+  }
+  bool full = true;
+  for (auto _ : state) {
+    full = !full;
+    const int newSize = full ? size : size / 2;
+    if (!fbo->resize(newSize, newSize)) {
+      state.SkipWithError("Unable to resize FBO");
+      return;
+    }
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glFinish();
+  }
+}
+
+int registerContextBenchmarks()
+{
+  struct Version {
+    const char *name;
+    unsigned int major;
+    unsigned int minor;
+    bool gles;
+  };
+  const Version versions[] = {
+    {"GL3.3", 3, 3, false},
+    {"GLES3.0", 3, 0, true},
+  };
+  for (const auto& provider : benchProviders()) {
+    for (const auto& version : versions) {
+      benchmark::RegisterBenchmark(("BM_ContextCreation/" + provider + "/" + version.name).c_str(),
+                                   BM_ContextCreation, provider, version.major, version.minor, version.gles)
+        ->Unit(benchmark::kMillisecond);
+    }
+    benchmark::RegisterBenchmark(("BM_CreateFBO/" + provider).c_str(), BM_CreateFBO, provider)
+      ->RangeMultiplier(2)->Range(512, 8192)->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("BM_ResizeFBO/" + provider).c_str(), BM_ResizeFBO, provider)
+      ->RangeMultiplier(2)->Range(512, 8192)->Unit(benchmark::kMillisecond);
+  }
+  return 0;
+}
+
+const int contextBenchmarks = registerContextBenchmarks();
+
+} // namespace
@@ -0,0 +1,73 @@
+// Frame throughput with one rendering thread per context of an OffscreenContextPool,
+// each rendering into its own FBO with programs and buffers shared between them.
+
+#include <benchmark/benchmark.h>
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "bench_context.h"
+#include "system-gl.h"
+#include "FBO.h"
+#include "OffscreenContextPool.h"
+#include "PixelBuffer.h"
+#include "render_modern_ogl3.h"
+
+namespace {
+
+const int framesPerThread = 16;
+
+void BM_ContextPool(benchmark::State& state, const std::string& provider)
+{
+  const int numThreads = state.range(0);
+  const int size = state.range(1);
+  auto ctx = createBenchContext(provider, size, size);
+  if (!ctx) {
+    state.SkipWithError(("Unable to create " + provider + " context").c_str());
+    return;
+  }
+  std::vector<MyState> states;
+  ProgramRegistry programs;
+  std::ostringstream setupLog;
+  auto *coutBuffer = std::cout.rdbuf(setupLog.rdbuf());
+  setupModernOGL3(states, "330", programs);
+  std::cout.rdbuf(coutBuffer);
+
+  auto pool = createOffscreenContextPool(provider, ctx, numThreads);
+  if (!pool) {
+    state.SkipWithError("Unable to create context pool");
+    return;
+  }
+  ctx->releaseCurrent();
+  for (auto _ : state) {
+    pool->run([&](OpenGLContext& workerCtx) {
+      auto fbo = createFBO(workerCtx);
+      if (!fbo) return;
+      const auto workerStates = shareModernOGL3(states);
+      glViewport(0, 0, size, size);
+      PixelBuffer buffer;
+      for (int i = 0; i < framesPerThread; ++i) {
+        renderModernOGL3(workerStates);
+        workerCtx.getFramebuffer(buffer);
+        benchmark::DoNotOptimize(buffer.data());
+      }
+    });
+  }
+  ctx->makeCurrent();
+  state.SetItemsProcessed(state.iterations() * numThreads * framesPerThread);
+}
+
+int registerContextPoolBenchmarks()
+{
+  for (const auto& provider : benchProviders()) {
+    if (provider != "egl") continue;
+    benchmark::RegisterBenchmark(("BM_ContextPool/" + provider).c_str(), BM_ContextPool, provider)
+      ->ArgsProduct({{1, 2, 4, 8}, {256, 1024}})->Unit(benchmark::kMillisecond)->UseRealTime();
+  }
+  return 0;
+}
+
+const int contextPoolBenchmarks = registerContextPoolBenchmarks();
+
+} // namespace
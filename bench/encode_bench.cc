@@ -0,0 +1,89 @@
+// Encoding a rendered frame in each output format, through writeImage() into a temporary file.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "bench_context.h"
+#include "system-gl.h"
+#include "FBO.h"
+#include "PixelBuffer.h"
+#include "image_writers.h"
+#include "render_modern_ogl3.h"
+
+namespace {
+
+// Reads back the scene main() renders, so compressors see realistic content
+bool renderScene(int size, PixelBuffer& buffer)
+{
+  auto ctx = createBenchContext(benchProviders().front(), size, size);
+  if (!ctx) return false;
+  auto fbo = createFBO(*ctx);
+  if (!fbo) return false;
+  std::vector<MyState> states;
+  ProgramRegistry programs;
+  std::ostringstream setupLog;
+  auto *coutBuffer = std::cout.rdbuf(setupLog.rdbuf());
+  setupModernOGL3(states, "330", programs);
+  std::cout.rdbuf(coutBuffer);
+  glViewport(0, 0, size, size);
+  renderModernOGL3(states);
+  return ctx->getFramebuffer(buffer);
+}
+
+void BM_Encode(benchmark::State& state, ImageFormat format, unsigned int pngThreads)
+{
+  const int size = state.range(0);
+  PixelBuffer buffer;
+  if (benchProviders().empty() || !renderScene(size, buffer)) {
+    state.SkipWithError("Unable to render the scene");
+    return;
+  }
+  OutputOptions options;
+  options.format = format;
+  options.pngThreads = pngThreads;
+  const auto path = std::filesystem::temp_directory_path() /
+    (std::string("offscreen_bench_encode.") + imageFormatName(format));
+  for (auto _ : state) {
+    if (!writeImage(path.string().c_str(), size, size, buffer.data(), options)) {
+      state.SkipWithError("Unable to write image");
+      return;
+    }
+  }
+  state.SetLabel(std::to_string(std::filesystem::file_size(path)) + " bytes");
+  state.SetBytesProcessed(state.iterations() * buffer.size());
+  std::remove(path.string().c_str());
+}
+
+int registerEncodeBenchmarks()
+{
+  struct Encoder {
+    const char *name;
+    ImageFormat format;
+    unsigned int pngThreads;
+  };
+  const Encoder encoders[] = {
+    {"PNG", ImageFormat::PNG, 0},  // stb_image_write
+#ifdef HAS_ZLIB
+    {"PNG4Threads", ImageFormat::PNG, 4},
+#endif
+    {"QOI", ImageFormat::QOI, 0},
+    {"PAM", ImageFormat::PAM, 0},
+    {"PPM", ImageFormat::PPM, 0},
+    {"RAW", ImageFormat::RAW, 0},
+  };
+  for (const auto& encoder : encoders) {
+    benchmark::RegisterBenchmark((std::string("BM_Encode/") + encoder.name).c_str(), BM_Encode,
+                                 encoder.format, encoder.pngThreads)
+      ->Arg(512)->Arg(2048)->Unit(benchmark::kMillisecond);
+  }
+  return 0;
+}
+
+const int encodeBenchmarks = registerEncodeBenchmarks();
+
+} // namespace
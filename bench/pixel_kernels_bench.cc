@@ -0,0 +1,79 @@
+// Runs each pixel conversion kernel with every instruction set this CPU supports.
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+#include "PixelBuffer.h"
+#include "pixel_convert.h"
+
+namespace {
+
+enum class Kernel {
+  SwizzleRB,
+  RGBAToRGB,
+  Premultiply,
+  Unpremultiply,
+  FlipRows,
+};
+
+void BM_PixelKernel(benchmark::State& state, Kernel kernel, PixelISA isa)
+{
+  if (!setPixelISA(isa)) {
+    state.SkipWithError("Instruction set not supported");
+    return;
+  }
+  const size_t size = state.range(0);
+  const size_t numPixels = size * size;
+  PixelBuffer src, dst;
+  src.resize(4 * numPixels);
+  dst.resize(4 * numPixels);
+  for (size_t i = 0; i < src.size(); ++i) src.data()[i] = i * 37;
+
+  for (auto _ : state) {
+    switch (kernel) {
+    case Kernel::SwizzleRB:
+      swizzleRB(src.data(), dst.data(), numPixels);
+      break;
+    case Kernel::RGBAToRGB:
+      rgbaToRGB(src.data(), dst.data(), numPixels);
+      break;
+    case Kernel::Premultiply:
+      premultiplyAlpha(src.data(), dst.data(), numPixels);
+      break;
+    case Kernel::Unpremultiply:
+      unpremultiplyAlpha(src.data(), dst.data(), numPixels);
+      break;
+    case Kernel::FlipRows:
+      flipRows(src.data(), 4 * size, size);
+      break;
+    }
+    benchmark::DoNotOptimize(dst.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * src.size());
+  setPixelISA(supportedPixelISAs().back());
+}
+
+int registerPixelKernelBenchmarks()
+{
+  const std::pair<Kernel, const char *> kernels[] = {
+    {Kernel::SwizzleRB, "SwizzleRB"},
+    {Kernel::RGBAToRGB, "RGBAToRGB"},
+    {Kernel::Premultiply, "Premultiply"},
+    {Kernel::Unpremultiply, "Unpremultiply"},
+    {Kernel::FlipRows, "FlipRows"},
+  };
+  for (const auto& [kernel, name] : kernels) {
+    for (const auto isa : supportedPixelISAs()) {
+      benchmark::RegisterBenchmark((std::string("BM_PixelKernel/") + name + "/" + pixelISAName(isa)).c_str(),
+                                   BM_PixelKernel, kernel, isa)
+        ->Arg(256)->Arg(1024)->Arg(2048)->Unit(benchmark::kMicrosecond);
+    }
+  }
+  return 0;
+}
+
+const int pixelKernelBenchmarks = registerPixelKernelBenchmarks();
+
+} // namespace
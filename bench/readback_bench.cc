@@ -0,0 +1,85 @@
+// Compares glReadPixels() in plain RGBA against the implementation's preferred read format,
+// on every context provider in the build.
+
+#include <benchmark/benchmark.h>
+
+#include "bench_context.h"
+#include "system-gl.h"
+#include "FBO.h"
+#include "PixelBuffer.h"
+#include "pixel_convert.h"
+
+namespace {
+
+enum class ReadMode {
+  RGBA,          // Always GL_RGBA, whatever the driver prefers
+  Native,        // Preferred format, left as is (e.g. for the Y4M converter)
+  NativeToRGBA,  // Preferred format, swizzled to RGBA if needed: what getFramebuffer() does
+  BGRAToRGBA,    // Always GL_BGRA plus swizzle, to see the cost where RGBA is native
+};
+
+void BM_Readback(benchmark::State& state, const std::string& provider, ReadMode mode)
+{
+  const int size = state.range(0);
+  auto ctx = createBenchContext(provider, size, size);
+  if (!ctx) {
+    state.SkipWithError(("Unable to create " + provider + " context").c_str());
+    return;
+  }
+  auto fbo = createFBO(*ctx);
+  if (!fbo) {
+    state.SkipWithError("Unable to create FBO");
+    return;
+  }
+  ctx->queryReadFormat();
+  state.SetLabel(ctx->readsBGRA() ? "prefers BGRA" : "prefers RGBA");
+
+  glClearColor(0.2f, 0.4f, 0.6f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT);
+  glFinish();
+
+  PixelBuffer buffer;
+  buffer.resize(ctx->framebufferSize());
+  const size_t numPixels = static_cast<size_t>(size) * size;
+  for (auto _ : state) {
+    switch (mode) {
+    case ReadMode::RGBA:
+      glReadPixels(0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, buffer.data());
+      break;
+    case ReadMode::Native:
+      ctx->getFramebuffer(buffer, /*convertToRGBA*/ false);
+      break;
+    case ReadMode::NativeToRGBA:
+      ctx->getFramebuffer(buffer);
+      break;
+    case ReadMode::BGRAToRGBA:
+      glReadPixels(0, 0, size, size, GL_BGRA, GL_UNSIGNED_BYTE, buffer.data());
+      swizzleRB(buffer.data(), buffer.data(), numPixels);
+      break;
+    }
+    benchmark::DoNotOptimize(buffer.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+
+int registerReadbackBenchmarks()
+{
+  const std::pair<ReadMode, const char *> modes[] = {
+    {ReadMode::RGBA, "RGBA"},
+    {ReadMode::Native, "Native"},
+    {ReadMode::NativeToRGBA, "NativeToRGBA"},
+    {ReadMode::BGRAToRGBA, "BGRAToRGBA"},
+  };
+  for (const auto& provider : benchProviders()) {
+    for (const auto& [mode, name] : modes) {
+      benchmark::RegisterBenchmark(("BM_Readback/" + provider + "/" + name).c_str(), BM_Readback, provider, mode)
+        ->RangeMultiplier(2)->Range(512, 8192)->Unit(benchmark::kMicrosecond);
+    }
+  }
+  return 0;
+}
+
+const int readbackBenchmarks = registerReadbackBenchmarks();
+
+} // namespace
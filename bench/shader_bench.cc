@@ -0,0 +1,65 @@
+// Compiling and linking the scene's shaders, and uploading its buffers, in setupModernOGL3().
+
+#include <benchmark/benchmark.h>
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "bench_context.h"
+#include "system-gl.h"
+#include "render_modern_ogl3.h"
+#include "state.h"
+
+namespace {
+
+void BM_SetupModernOGL3(benchmark::State& state, const std::string& provider, bool gles)
+{
+  auto ctx = createBenchContext(provider, 256, 256, 3, gles ? 0 : 3, gles);
+  if (!ctx) {
+    state.SkipWithError(("Unable to create " + provider + " context").c_str());
+    return;
+  }
+  const std::string glslVersion = gles ? "300 es" : "330";
+  std::ostringstream setupLog;
+  auto *coutBuffer = std::cout.rdbuf(setupLog.rdbuf());
+  for (auto _ : state) {
+    std::vector<MyState> states;
+    ProgramRegistry programs;
+    setupModernOGL3(states, glslVersion, programs);
+    // Drivers may link in the background, so wait for the programs to be usable
+    for (const auto& s : states) {
+      GLint linked = GL_FALSE;
+      glGetProgramiv(s.shaderProgram, GL_LINK_STATUS, &linked);
+      benchmark::DoNotOptimize(linked);
+    }
+
+    state.PauseTiming();
+    programs.destroy();
+    for (const auto& s : states) {
+      glDeleteVertexArrays(1, &s.vao);
+      glDeleteBuffers(1, &s.vbo);
+      glDeleteBuffers(1, &s.ebo);
+    }
+    setupLog.str("");
+    state.ResumeTiming();
+  }
+  std::cout.rdbuf(coutBuffer);
+}
+
+int registerShaderBenchmarks()
+{
+  for (const auto& provider : benchProviders()) {
+    benchmark::RegisterBenchmark(("BM_SetupModernOGL3/" + provider + "/GL3.3").c_str(), BM_SetupModernOGL3,
+                                 provider, false)
+      ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("BM_SetupModernOGL3/" + provider + "/GLES3.0").c_str(), BM_SetupModernOGL3,
+                                 provider, true)
+      ->Unit(benchmark::kMillisecond);
+  }
+  return 0;
+}
+
+const int shaderBenchmarks = registerShaderBenchmarks();
+
+} // namespace
@@ -0,0 +1,42 @@
+# FindXXHASH
+# ----------
+# Finds the xxHash library
+#
+# This will define the following variables::
+#
+# XXHASH_FOUND - system has xxHash
+# XXHASH_INCLUDE_DIRS - the xxHash include directory
+# XXHASH_LIBRARIES - the xxHash libraries
+#
+# and the following imported targets::
+#
+#   XXHASH::XXHASH   - The xxHash library
+
+if(PKG_CONFIG_FOUND)
+  pkg_check_modules(PC_XXHASH libxxhash QUIET)
+endif()
+
+find_path(XXHASH_INCLUDE_DIR NAMES xxhash.h
+                             PATHS ${PC_XXHASH_INCLUDEDIR})
+find_library(XXHASH_LIBRARY NAMES xxhash
+                            PATHS ${PC_XXHASH_LIBDIR})
+
+set(XXHASH_VERSION ${PC_XXHASH_VERSION})
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(XXHASH
+                                  REQUIRED_VARS XXHASH_LIBRARY XXHASH_INCLUDE_DIR
+                                  VERSION_VAR XXHASH_VERSION)
+
+if(XXHASH_FOUND)
+  set(XXHASH_LIBRARIES ${XXHASH_LIBRARY})
+  set(XXHASH_INCLUDE_DIRS ${XXHASH_INCLUDE_DIR})
+  if(NOT TARGET XXHASH::XXHASH)
+    add_library(XXHASH::XXHASH UNKNOWN IMPORTED)
+    set_target_properties(XXHASH::XXHASH PROPERTIES
+                                         IMPORTED_LOCATION "${XXHASH_LIBRARY}"
+                                         INTERFACE_INCLUDE_DIRECTORIES "${XXHASH_INCLUDE_DIR}")
+  endif()
+endif()
+
+mark_as_advanced(XXHASH_INCLUDE_DIR XXHASH_LIBRARY)
@@ -0,0 +1,139 @@
+#include "AsyncReadback.h"
+
+#include "system-gl.h"
+#include "GpuProfiler.h"
+#include "pixel_convert.h"
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+std::unique_ptr<AsyncReadback> createAsyncReadback(const OpenGLContext& ctx, size_t numBuffers) {
+  return createAsyncReadback(ctx, numBuffers, {0, 0, ctx.width(), ctx.height()});
+}
+
+std::unique_ptr<AsyncReadback> createAsyncReadback(const OpenGLContext& ctx, size_t numBuffers, const PixelRect& rect) {
+  // Pixel pack buffers and glMapBufferRange() are core in OpenGL 3.0 and GLES 3.0,
+  // fence sync objects in OpenGL 3.2 and GLES 3.0.
+  const bool hasPBO = ctx.majorVersion() >= 3;
+  const bool hasSync = ctx.isGLES() || ctx.majorVersion() > 3 ||
+    (ctx.majorVersion() == 3 && ctx.minorVersion() >= 2) || hasGLExtension(GL_ARB_sync);
+  if (!hasPBO || !hasSync) {
+    std::cerr << "Asynchronous readback not supported" << std::endl;
+    return nullptr;
+  }
+  if (numBuffers == 0) numBuffers = 1;
+  return std::make_unique<AsyncReadback>(rect, numBuffers, ctx.readsBGRA());
+}
+
+AsyncReadback::AsyncReadback(int width, int height, size_t numBuffers, bool readBGRA)
+  : AsyncReadback(PixelRect{0, 0, width, height}, numBuffers, readBGRA) {
+}
+
+AsyncReadback::AsyncReadback(const PixelRect& rect, size_t numBuffers, bool readBGRA)
+  : x(rect.x), y(rect.y), width(rect.width), height(rect.height), readBGRA(readBGRA), slots(numBuffers) {
+  for (auto& slot : this->slots) {
+    GL_CHECK(glGenBuffers(1, &slot.pbo));
+    GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo));
+    GL_CHECK(glBufferData(GL_PIXEL_PACK_BUFFER, this->bufferSize(), nullptr, GL_STREAM_READ));
+  }
+  GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+}
+
+bool AsyncReadback::requestReadback()
+{
+  if (this->isFull()) return false;
+
+  auto& slot = this->slots[this->head];
+  GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo));
+  {
+    GpuPass pass("Readback");
+    GL_CHECK(glReadPixels(this->x, this->y, this->width, this->height, this->readBGRA ? GL_BGRA : GL_RGBA, GL_UNSIGNED_BYTE,
+                          nullptr));
+  }
+  GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  // Make sure the fence reaches the GPU, so it will eventually signal without us waiting on it
+  GL_CHECK(glFlush());
+
+  this->head = (this->head + 1) % this->slots.size();
+  this->pending++;
+  return true;
+}
+
+bool AsyncReadback::tryCollect(PixelBuffer& buffer)
+{
+  if (this->pending == 0) return false;
+
+  // Without the flush bit, a fence still queued in the driver would never signal
+  const auto status = glClientWaitSync(this->slots[this->tail].fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+  if (status == GL_TIMEOUT_EXPIRED) return false;
+  if (status == GL_WAIT_FAILED) {
+    std::cerr << "glClientWaitSync() failed" << std::endl;
+    return false;
+  }
+  return this->copyOut(buffer);
+}
+
+bool AsyncReadback::collect(PixelBuffer& buffer)
+{
+  if (this->pending == 0) return false;
+
+  GLenum status;
+  do {
+    // Wait in chunks of 100ms; drivers are allowed to cap the timeout
+    status = glClientWaitSync(this->slots[this->tail].fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000);
+  } while (status == GL_TIMEOUT_EXPIRED);
+  if (status == GL_WAIT_FAILED) {
+    std::cerr << "glClientWaitSync() failed" << std::endl;
+    return false;
+  }
+  return this->copyOut(buffer);
+}
+
+bool AsyncReadback::copyOut(PixelBuffer& buffer)
+{
+  auto& slot = this->slots[this->tail];
+  const auto size = this->bufferSize();
+  GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo));
+  const void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+  if (!mapped) {
+    std::cerr << "glMapBufferRange() failed" << std::endl;
+    GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+    return false;
+  }
+  buffer.resize(size);
+  if (this->readBGRA) {
+    swizzleRB(static_cast<const uint8_t *>(mapped), buffer.data(), size / 4);
+  } else {
+    memcpy(buffer.data(), mapped, size);
+  }
+  GL_CHECK(const GLboolean unmapped = glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+  GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+  if (!unmapped) {
+    std::cerr << "glUnmapBuffer() failed" << std::endl;
+    return false;
+  }
+
+  // Only once the frame is out, so a failed copy leaves it pending
+  glDeleteSync(slot.fence);
+  slot.fence = nullptr;
+  this->tail = (this->tail + 1) % this->slots.size();
+  this->pending--;
+  return true;
+}
+
+void AsyncReadback::destroy()
+{
+  for (auto& slot : this->slots) {
+    if (slot.fence) {
+      glDeleteSync(slot.fence);
+      slot.fence = nullptr;
+    }
+    if (slot.pbo != 0) {
+      GL_CHECK(glDeleteBuffers(1, &slot.pbo));
+      slot.pbo = 0;
+    }
+  }
+  this->pending = 0;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "system-gl.h"
+#include "OpenGLContext.h"
+#include "PixelBuffer.h"
+
+// Asynchronous framebuffer readback using a ring of pixel pack buffers.
+// requestReadback() queues a glReadPixels() into the next free PBO and
+// inserts a fence behind it, so the CPU can keep submitting work while the
+// copy completes. tryCollect() returns the oldest frame once its fence has
+// signaled, without blocking.
+class AsyncReadback
+{
+  struct Slot {
+    GLuint pbo = 0;
+    GLsync fence = nullptr;
+  };
+
+  int x;
+  int y;
+  int width;
+  int height;
+  bool readBGRA;  // Read in the driver's preferred order, convert while copying out
+  std::vector<Slot> slots;
+  size_t head = 0;  // Next slot to read into
+  size_t tail = 0;  // Oldest pending slot
+  size_t pending = 0;
+
+  bool copyOut(PixelBuffer& buffer);
+
+public:
+  AsyncReadback(int width, int height, size_t numBuffers, bool readBGRA = false);
+  AsyncReadback(const PixelRect& rect, size_t numBuffers, bool readBGRA = false);
+  ~AsyncReadback() { destroy(); };
+  size_t bufferSize() const { return 4 * static_cast<size_t>(this->width) * this->height; }
+  size_t numPending() const { return this->pending; }
+  bool isFull() const { return this->pending == this->slots.size(); }
+  // Returns false if all buffers are in flight.
+  bool requestReadback();
+  // Returns false if no readback has completed yet.
+  bool tryCollect(PixelBuffer& buffer);
+  // Waits for the oldest pending readback. Returns false if none is pending.
+  bool collect(PixelBuffer& buffer);
+  void destroy();
+};
+
+std::unique_ptr<AsyncReadback> createAsyncReadback(const OpenGLContext &ctx, size_t numBuffers);
+// Reads back a region instead of the whole framebuffer. The region may lie in a read framebuffer
+// of a different size than the context's, e.g. the output of the GPU YUV pass.
+std::unique_ptr<AsyncReadback> createAsyncReadback(const OpenGLContext &ctx, size_t numBuffers, const PixelRect& rect);
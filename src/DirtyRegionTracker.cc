@@ -0,0 +1,197 @@
+#include "DirtyRegionTracker.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "shader_cache.h"
+
+namespace {
+
+const char *dirty_vert_body = R"(
+    void main() {
+      vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+      gl_Position = vec4(pos * 2.0 - 1.0, 0.0, 1.0);
+    }
+  )";
+
+// One fragment per tile, white if any pixel in it differs
+const char *dirty_frag_body = R"(
+    uniform sampler2D currentFrame;
+    uniform sampler2D previousFrame;
+    uniform int tileSize;
+    uniform ivec2 size;
+
+    void main() {
+      ivec2 origin = ivec2(gl_FragCoord.xy) * tileSize;
+      ivec2 end = min(origin + tileSize, size);
+      float changed = 0.0;
+      for (int y = origin.y; y < end.y && changed == 0.0; ++y) {
+        for (int x = origin.x; x < end.x; ++x) {
+          if (texelFetch(currentFrame, ivec2(x, y), 0) != texelFetch(previousFrame, ivec2(x, y), 0)) {
+            changed = 1.0;
+            break;
+          }
+        }
+      }
+      FragColor = vec4(changed);
+    }
+  )";
+
+} // namespace
+
+std::unique_ptr<DirtyRegionTracker> createDirtyRegionTracker(const OpenGLContext& ctx, const std::string& glslVersion,
+                                                             const PixelRect& region, int tileSize)
+{
+  // texelFetch() and separate read/draw framebuffers
+  if (ctx.majorVersion() < 3) {
+    std::cerr << "Dirty region tracking needs OpenGL 3 or GLES 3" << std::endl;
+    return nullptr;
+  }
+  if (tileSize <= 0 || region.width <= 0 || region.height <= 0) {
+    std::cerr << "Invalid dirty region tracking parameters" << std::endl;
+    return nullptr;
+  }
+  auto tracker = std::make_unique<DirtyRegionTracker>(region, tileSize);
+  if (!tracker->setup(glslVersion)) return nullptr;
+  return tracker;
+}
+
+DirtyRegionTracker::DirtyRegionTracker(const PixelRect& region, int tileSize)
+  : region(region), tileSize(tileSize),
+    tilesX((region.width + tileSize - 1) / tileSize), tilesY((region.height + tileSize - 1) / tileSize)
+{
+}
+
+bool DirtyRegionTracker::setup(const std::string& glslVersion)
+{
+  std::string header;
+  if (glslVersion == "330") {
+    header = "#version 330 core\n";
+  } else if (glslVersion == "140") {
+    header = "#version 140\n";
+  } else if (glslVersion == "300 es") {
+    header = "#version 300 es\nprecision highp float;\nprecision highp int;\n";
+  } else {
+    std::cerr << "Dirty region tracking not implemented for GLSL " << glslVersion << std::endl;
+    return false;
+  }
+  const std::string vertexSource = header + dirty_vert_body;
+  const std::string fragmentSource = header + "out vec4 FragColor;\n" + dirty_frag_body;
+  this->program = linkProgram(vertexSource.c_str(), fragmentSource.c_str());
+  if (!this->program) return false;
+  GL_CHECK(glUseProgram(this->program));
+  GL_CHECK(glUniform1i(glGetUniformLocation(this->program, "currentFrame"), 0));
+  GL_CHECK(glUniform1i(glGetUniformLocation(this->program, "previousFrame"), 1));
+  GL_CHECK(glUniform1i(glGetUniformLocation(this->program, "tileSize"), this->tileSize));
+  GL_CHECK(glUniform2i(glGetUniformLocation(this->program, "size"), this->region.width, this->region.height));
+  GL_CHECK(glGenVertexArrays(1, &this->vao));
+
+  GL_CHECK(glGenTextures(2, this->textures));
+  for (const auto texture : this->textures) {
+    GL_CHECK(glBindTexture(GL_TEXTURE_2D, texture));
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+    GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, this->region.width, this->region.height, 0,
+                          GL_RGBA, GL_UNSIGNED_BYTE, nullptr));
+  }
+  GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+
+  GLint drawFbo;
+  GLint readFbo;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFbo);
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFbo);
+  GL_CHECK(glGenFramebuffers(1, &this->fbo));
+  GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, this->fbo));
+  GL_CHECK(glGenRenderbuffers(1, &this->renderbuffer));
+  GL_CHECK(glBindRenderbuffer(GL_RENDERBUFFER, this->renderbuffer));
+  GL_CHECK(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, this->tilesX, this->tilesY));
+  GL_CHECK(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->renderbuffer));
+  const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  GL_CHECK(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFbo));
+  GL_CHECK(glBindFramebuffer(GL_READ_FRAMEBUFFER, readFbo));
+  if (!complete) {
+    std::cerr << "Dirty region framebuffer incomplete" << std::endl;
+    return false;
+  }
+  this->mask.resize(4 * this->numTiles());
+  return true;
+}
+
+const std::vector<PixelRect>& DirtyRegionTracker::update()
+{
+  GLint drawFbo;
+  GLint readFbo;
+  GLint viewport[4];
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFbo);
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFbo);
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  const auto& r = this->region;
+  GL_CHECK(glActiveTexture(GL_TEXTURE0));
+  GL_CHECK(glBindTexture(GL_TEXTURE_2D, this->textures[this->current]));
+  GL_CHECK(glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, r.x, r.y, r.width, r.height));
+
+  if (this->hasPrevious) {
+    GL_CHECK(glActiveTexture(GL_TEXTURE1));
+    GL_CHECK(glBindTexture(GL_TEXTURE_2D, this->textures[1 - this->current]));
+    GL_CHECK(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->fbo));
+    GL_CHECK(glViewport(0, 0, this->tilesX, this->tilesY));
+    GL_CHECK(glUseProgram(this->program));
+    GL_CHECK(glBindVertexArray(this->vao));
+    GL_CHECK(glDrawArrays(GL_TRIANGLES, 0, 3));
+    GL_CHECK(glBindFramebuffer(GL_READ_FRAMEBUFFER, this->fbo));
+    GL_CHECK(glReadPixels(0, 0, this->tilesX, this->tilesY, GL_RGBA, GL_UNSIGNED_BYTE, this->mask.data()));
+    GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+    GL_CHECK(glActiveTexture(GL_TEXTURE0));
+  } else {
+    std::fill(this->mask.begin(), this->mask.end(), 0xff);
+  }
+  GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+  GL_CHECK(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFbo));
+  GL_CHECK(glBindFramebuffer(GL_READ_FRAMEBUFFER, readFbo));
+  GL_CHECK(glViewport(viewport[0], viewport[1], viewport[2], viewport[3]));
+  this->current = 1 - this->current;
+  this->hasPrevious = true;
+
+  // Merge runs of dirty tiles within a row, so each run is a single glReadPixels()
+  this->dirty.clear();
+  this->numDirtyTiles = 0;
+  for (int ty = 0; ty < this->tilesY; ++ty) {
+    for (int tx = 0; tx < this->tilesX; ++tx) {
+      if (this->mask[4 * (ty * this->tilesX + tx)] == 0) continue;
+      const int startX = tx;
+      while (tx + 1 < this->tilesX && this->mask[4 * (ty * this->tilesX + tx + 1)] != 0) ++tx;
+      this->numDirtyTiles += tx - startX + 1;
+      const int x0 = startX * this->tileSize;
+      const int y0 = ty * this->tileSize;
+      this->dirty.push_back({r.x + x0, r.y + y0,
+                             std::min((tx + 1) * this->tileSize, r.width) - x0,
+                             std::min(y0 + this->tileSize, r.height) - y0});
+    }
+  }
+  return this->dirty;
+}
+
+void DirtyRegionTracker::destroy()
+{
+  if (this->program) {
+    glDeleteProgram(this->program);
+    this->program = 0;
+  }
+  if (this->vao) {
+    glDeleteVertexArrays(1, &this->vao);
+    this->vao = 0;
+  }
+  if (this->textures[0]) {
+    glDeleteTextures(2, this->textures);
+    this->textures[0] = this->textures[1] = 0;
+  }
+  if (this->renderbuffer) {
+    glDeleteRenderbuffers(1, &this->renderbuffer);
+    this->renderbuffer = 0;
+  }
+  if (this->fbo) {
+    glDeleteFramebuffers(1, &this->fbo);
+    this->fbo = 0;
+  }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "system-gl.h"
+#include "OpenGLContext.h"
+#include "PixelBuffer.h"
+
+// Finds the tiles of the framebuffer that changed since the previous frame.
+// Each frame is copied into a texture on the GPU and compared with the last one by a shader
+// writing one pixel per tile, so only that tiny mask is read back to decide which tiles
+// need a full readback.
+class DirtyRegionTracker
+{
+  PixelRect region;
+  int tileSize;
+  int tilesX;
+  int tilesY;
+  GLuint program = 0;
+  GLuint vao = 0;
+  GLuint textures[2] = {0, 0};  // Alternating between current and previous frame
+  int current = 0;
+  bool hasPrevious = false;
+  GLuint fbo = 0;
+  GLuint renderbuffer = 0;
+  std::vector<uint8_t> mask;
+  std::vector<PixelRect> dirty;
+  size_t numDirtyTiles = 0;
+
+public:
+  DirtyRegionTracker(const PixelRect& region, int tileSize);
+  ~DirtyRegionTracker() { destroy(); }
+  bool setup(const std::string& glslVersion);
+  // Compares the read framebuffer with the previous call. Returns the changed regions in framebuffer
+  // coordinates, adjacent tiles in a row merged. Everything is dirty on the first call.
+  const std::vector<PixelRect>& update();
+  size_t numTiles() const { return static_cast<size_t>(this->tilesX) * this->tilesY; }
+  // Number of changed tiles found by the last update()
+  size_t lastDirtyTiles() const { return this->numDirtyTiles; }
+  void destroy();
+};
+
+// Tracks changes within region of the framebuffer. Needs OpenGL 3 or GLES 3; returns nullptr if unsupported.
+std::unique_ptr<DirtyRegionTracker> createDirtyRegionTracker(const OpenGLContext& ctx, const std::string& glslVersion,
+                                                             const PixelRect& region, int tileSize);
@@ -52,7 +52,20 @@ bool checkFBOStatus() {
 
 }  // namespace
 
-std::unique_ptr<FBO> createFBO(const OpenGLContext& ctx) {
+std::unique_ptr<FBO> createFBO(const OpenGLContext& ctx, int numSamples) {
+  if (numSamples > 0) {
+    if (ctx.majorVersion() < 3 && (ctx.isGLES() || !hasGLExtension(GL_ARB_framebuffer_object))) {
+      std::cerr << "Multisampled Framebuffer Objects not supported" << std::endl;
+      return nullptr;
+    }
+    GLint maxSamples = 0;
+    glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+    if (numSamples > maxSamples) {
+      std::cerr << "Requested " << numSamples << " samples, using GL_MAX_SAMPLES (" << maxSamples << ")" << std::endl;
+      numSamples = maxSamples;
+    }
+    return std::make_unique<FBO>(ctx.width(), ctx.height(), /*useEXT*/ false, /*hasDepth*/ true, numSamples);
+  }
   if (ctx.majorVersion() >= 3 || ctx.isGLES() || hasGLExtension(GL_ARB_framebuffer_object)) {
     return std::make_unique<FBO>(ctx.width(), ctx.height(), /*useEXT*/ false);
   } else if (hasGLExtension(GL_EXT_framebuffer_object)) {
@@ -63,13 +76,27 @@ std::unique_ptr<FBO> createFBO(const OpenGLContext& ctx) {
   }
 }
 
-FBO::FBO(int width, int height, bool useEXT) : useEXT(useEXT) {
+std::unique_ptr<FBO> createBlitFBO(const OpenGLContext& ctx) {
+  if (ctx.isGLES() ? ctx.majorVersion() >= 3 :
+      ctx.majorVersion() >= 3 || hasGLExtension(GL_ARB_framebuffer_object)) {
+    return std::make_unique<FBO>(ctx.width(), ctx.height(), /*useEXT*/ false, /*hasDepth*/ false);
+  } else if (hasGLExtension(GL_EXT_framebuffer_object) && hasGLExtension(GL_EXT_framebuffer_blit)) {
+    return std::make_unique<FBO>(ctx.width(), ctx.height(), /*useEXT*/ true, /*hasDepth*/ false);
+  } else {
+    return nullptr;
+  }
+}
+
+FBO::FBO(int width, int height, bool useEXT, bool hasDepth, int numSamples)
+  : useEXT(useEXT), hasDepth(hasDepth), numSamples(numSamples) {
   // Generate and bind FBO
   GL_CHECK(glGenFramebuffers(1, &this->fbo_id));
   this->bind();
 
   // Generate depth and render buffers
-  GL_CHECK(glGenRenderbuffers(1, &this->depthbuf_id));
+  if (this->hasDepth) {
+    GL_CHECK(glGenRenderbuffers(1, &this->depthbuf_id));
+  }
   GL_CHECK(glGenRenderbuffers(1, &this->renderbuf_id));
 
   // Create buffers with correct size
@@ -84,17 +111,19 @@ FBO::FBO(int width, int height, bool useEXT) : useEXT(useEXT) {
     return;
   }
 
-  //glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
-  // to prevent Mesa's software renderer from crashing, do this in two stages.
-  // ie. instead of using GL_DEPTH_STENCIL_ATTACHMENT, do DEPTH then STENCIL.
-  GL_CHECK(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-				     GL_RENDERBUFFER, this->depthbuf_id));
-  GL_CHECK(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT,
-				     GL_RENDERBUFFER, this->depthbuf_id));
-
-  if (!checkFBOStatus()) {
-    std::cerr << "Problem with OpenGL framebuffer after specifying depth render buffer.\n";
-    return;
+  if (this->hasDepth) {
+    //glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+    // to prevent Mesa's software renderer from crashing, do this in two stages.
+    // ie. instead of using GL_DEPTH_STENCIL_ATTACHMENT, do DEPTH then STENCIL.
+    GL_CHECK(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                       GL_RENDERBUFFER, this->depthbuf_id));
+    GL_CHECK(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT,
+                                       GL_RENDERBUFFER, this->depthbuf_id));
+
+    if (!checkFBOStatus()) {
+      std::cerr << "Problem with OpenGL framebuffer after specifying depth render buffer.\n";
+      return;
+    }
   }
 
   this->complete = true;
@@ -107,13 +136,23 @@ bool FBO::resize(size_t width, size_t height)
   } else {
     GL_CHECK(glBindRenderbuffer(GL_RENDERBUFFER, this->renderbuf_id));
   }
-  GL_CHECK(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height));
+  if (this->numSamples > 0) {
+    GL_CHECK(glRenderbufferStorageMultisample(GL_RENDERBUFFER, this->numSamples, GL_RGBA8, width, height));
+  } else {
+    GL_CHECK(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height));
+  }
+  if (!this->hasDepth) return true;
+
   if (this->useEXT) {
     GL_CHECK(glBindRenderbufferEXT(GL_RENDERBUFFER, this->depthbuf_id));
   } else {
     GL_CHECK(glBindRenderbuffer(GL_RENDERBUFFER, this->depthbuf_id));
   }
-  GL_CHECK(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height));
+  if (this->numSamples > 0) {
+    GL_CHECK(glRenderbufferStorageMultisample(GL_RENDERBUFFER, this->numSamples, GL_DEPTH24_STENCIL8, width, height));
+  } else {
+    GL_CHECK(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height));
+  }
 
   return true;
 }
@@ -139,6 +178,25 @@ void FBO::unbind()
   this->old_fbo_id = 0;
 }
 
+void FBO::blitTo(const FBO& target, int width, int height, bool flipY)
+{
+  const GLint dstY0 = flipY ? height : 0;
+  const GLint dstY1 = flipY ? 0 : height;
+  if (this->useEXT) {
+    GL_CHECK(glBindFramebufferEXT(GL_READ_FRAMEBUFFER_EXT, this->fbo_id));
+    GL_CHECK(glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER_EXT, target.fbo_id));
+    GL_CHECK(glBlitFramebufferEXT(0, 0, width, height, 0, dstY0, width, dstY1, GL_COLOR_BUFFER_BIT, GL_NEAREST));
+    GL_CHECK(glBindFramebufferEXT(GL_READ_FRAMEBUFFER_EXT, target.fbo_id));
+    GL_CHECK(glBindFramebufferEXT(GL_DRAW_FRAMEBUFFER_EXT, this->fbo_id));
+  } else {
+    GL_CHECK(glBindFramebuffer(GL_READ_FRAMEBUFFER, this->fbo_id));
+    GL_CHECK(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target.fbo_id));
+    GL_CHECK(glBlitFramebuffer(0, 0, width, height, 0, dstY0, width, dstY1, GL_COLOR_BUFFER_BIT, GL_NEAREST));
+    GL_CHECK(glBindFramebuffer(GL_READ_FRAMEBUFFER, target.fbo_id));
+    GL_CHECK(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->fbo_id));
+  }
+}
+
 void FBO::destroy()
 {
   this->unbind();
@@ -9,6 +9,8 @@
 class FBO
 {
   bool useEXT;
+  bool hasDepth;
+  int numSamples;
   GLuint fbo_id = 0;
   GLuint old_fbo_id = 0;
   GLuint renderbuf_id = 0;
@@ -16,13 +18,22 @@ class FBO
   bool complete = false;
 
 public:
-  FBO(int width, int height, bool useEXT);
+  // numSamples > 0 creates multisampled buffers, which need a blit into a single-sample FBO to be read
+  FBO(int width, int height, bool useEXT, bool hasDepth = true, int numSamples = 0);
   ~FBO() { destroy(); };
   bool isComplete() { return this->complete; }
+  int samples() const { return this->numSamples; }
   bool resize(size_t width, size_t height);
   GLuint bind();
   void unbind();
   void destroy();
+  // Copies our color buffer into target, optionally flipping it vertically.
+  // Multisampled buffers are resolved, but can't be flipped at the same time.
+  // Leaves target bound for reading and this FBO bound for drawing.
+  void blitTo(const FBO& target, int width, int height, bool flipY);
 };
 
-std::unique_ptr<FBO> createFBO(const OpenGLContext &ctx);
+// numSamples > 0 requests a multisampled FBO, clamped to GL_MAX_SAMPLES
+std::unique_ptr<FBO> createFBO(const OpenGLContext &ctx, int numSamples = 0);
+// Creates a color-only FBO to blit into, or nullptr if blitting isn't supported
+std::unique_ptr<FBO> createBlitFBO(const OpenGLContext &ctx);
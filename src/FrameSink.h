@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+
+#include "PixelBuffer.h"
+
+// Consumer of rendered frames, see renderFrames() in main.cc.
+// Sinks own the buffers frames are read back into, so they can recycle them.
+class FrameSink {
+ public:
+  virtual ~FrameSink() = default;
+  // Returns a buffer to read the next frame into. May block until one is available.
+  virtual PixelBuffer& acquireBuffer() = 0;
+  // Hands over a buffer returned by acquireBuffer(), filled with the next frame
+  virtual bool submitFrame(PixelBuffer& buffer) = 0;
+  // Gives back a buffer returned by acquireBuffer() without a frame, e.g. when reading back failed
+  virtual void releaseBuffer(PixelBuffer& buffer) {}
+  // Like submitFrame(), with the regions that differ from the previous frame (in OpenGL row order).
+  // Sinks which can update their output incrementally override this.
+  virtual bool submitFrame(PixelBuffer& buffer, const std::vector<PixelRect>& dirtyRegions) {
+    return this->submitFrame(buffer);
+  }
+  // Flushes all submitted frames
+  virtual bool finish() = 0;
+  // Number of frames found identical to the previous one, and not encoded again
+  virtual size_t framesSkipped() const { return 0; }
+};
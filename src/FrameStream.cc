@@ -0,0 +1,188 @@
+#include "FrameStream.h"
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+
+#include "frame_hash.h"
+
+namespace {
+
+// BT.601 limited range, as expected by most video encoders
+inline uint8_t rgbToY(int r, int g, int b) { return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16; }
+inline uint8_t rgbToU(int r, int g, int b) { return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128; }
+inline uint8_t rgbToV(int r, int g, int b) { return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128; }
+
+// Converts the part of an RGBA (or BGRA) image within [x0, x1) x [y0, y1) (top row first) to planar I420,
+// averaging chroma over 2x2 blocks. The region grows to whole chroma blocks. Odd sizes round the chroma planes up.
+void rgbaToI420(const uint8_t *rgba, int width, int height, bool bottomUp, bool bgra, uint8_t *yuv,
+                int x0, int y0, int x1, int y1)
+{
+  const int ri = bgra ? 2 : 0;
+  const int bi = bgra ? 0 : 2;
+  const int chromaWidth = (width + 1) / 2;
+  const int chromaHeight = (height + 1) / 2;
+  x0 &= ~1;
+  y0 &= ~1;
+  x1 = std::min(x1 + (x1 & 1), width);
+  y1 = std::min(y1 + (y1 & 1), height);
+  uint8_t *yPlane = yuv;
+  uint8_t *uPlane = yPlane + static_cast<size_t>(width) * height;
+  uint8_t *vPlane = uPlane + static_cast<size_t>(chromaWidth) * chromaHeight;
+  const auto rowPtr = [&](int y) {
+    return rgba + static_cast<size_t>(bottomUp ? height - 1 - y : y) * width * 4;
+  };
+
+  for (int y = y0; y < y1; ++y) {
+    const uint8_t *src = rowPtr(y);
+    uint8_t *dst = yPlane + static_cast<size_t>(y) * width;
+    for (int x = x0; x < x1; ++x) {
+      dst[x] = rgbToY(src[4 * x + ri], src[4 * x + 1], src[4 * x + bi]);
+    }
+  }
+
+  for (int cy = y0 / 2; cy < std::min((y1 + 1) / 2, chromaHeight); ++cy) {
+    const uint8_t *row0 = rowPtr(2 * cy);
+    const uint8_t *row1 = rowPtr(std::min(2 * cy + 1, height - 1));
+    for (int cx = x0 / 2; cx < std::min((x1 + 1) / 2, chromaWidth); ++cx) {
+      const int x0 = 4 * (2 * cx);
+      const int x1 = 4 * std::min(2 * cx + 1, width - 1);
+      const int r = (row0[x0 + ri] + row0[x1 + ri] + row1[x0 + ri] + row1[x1 + ri] + 2) >> 2;
+      const int g = (row0[x0 + 1] + row0[x1 + 1] + row1[x0 + 1] + row1[x1 + 1] + 2) >> 2;
+      const int b = (row0[x0 + bi] + row0[x1 + bi] + row1[x0 + bi] + row1[x1 + bi] + 2) >> 2;
+      uPlane[static_cast<size_t>(cy) * chromaWidth + cx] = rgbToU(r, g, b);
+      vPlane[static_cast<size_t>(cy) * chromaWidth + cx] = rgbToV(r, g, b);
+    }
+  }
+}
+
+} // namespace
+
+bool parseStreamFormat(const std::string& name, StreamFormat& format)
+{
+  std::string lower = name;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  if (lower == "y4m") {
+    format = StreamFormat::Y4M;
+  } else if (lower == "raw" || lower == "rgba") {
+    format = StreamFormat::RGBA;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<FrameStream> createFrameStream(const std::string& path, int width, int height,
+                                               StreamFormat format, unsigned int fps, bool bottomUp)
+{
+  FILE *file;
+  const bool toStdout = path == "-";
+  if (toStdout) {
+    file = stdout;
+  } else {
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+      std::cerr << "Unable to open " << path << " for writing" << std::endl;
+      return nullptr;
+    }
+  }
+
+  auto stream = std::make_unique<FrameStream>(file, !toStdout, width, height, format, bottomUp);
+  if (!stream->writeHeader(fps)) {
+    std::cerr << "Unable to write stream header" << std::endl;
+    return nullptr;
+  }
+  return stream;
+}
+
+FrameStream::FrameStream(FILE *file, bool ownsFile, int width, int height, StreamFormat format, bool bottomUp)
+  : file(file), ownsFile(ownsFile), width(width), height(height), format(format), bottomUp(bottomUp)
+{
+}
+
+bool FrameStream::writeHeader(unsigned int fps)
+{
+  if (this->format != StreamFormat::Y4M) return true;
+  return fprintf(this->file, "YUV4MPEG2 W%d H%d F%u:1 Ip A1:1 C420jpeg\n",
+                 this->width, this->height, fps) > 0;
+}
+
+size_t FrameStream::i420FrameSize() const
+{
+  const size_t chromaSize = static_cast<size_t>((this->width + 1) / 2) * ((this->height + 1) / 2);
+  return static_cast<size_t>(this->width) * this->height + 2 * chromaSize;
+}
+
+bool FrameStream::writeFrame(const uint8_t *rgba)
+{
+  if (!this->file) return false;
+
+  const size_t rowBytes = static_cast<size_t>(this->width) * 4;
+  bool ok = true;
+  if (this->format == StreamFormat::Y4M && this->i420Input) {
+    ok = fputs("FRAME\n", this->file) >= 0 &&
+      fwrite(rgba, 1, this->i420FrameSize(), this->file) == this->i420FrameSize();
+  } else if (this->format == StreamFormat::Y4M) {
+    if (this->skipDuplicates) {
+      const size_t size = static_cast<size_t>(this->width) * this->height * 4;
+      const uint64_t hash = hashFrame(rgba, size);
+      const bool duplicate = this->hasLastHash && hash == this->lastHash;
+      this->lastHash = hash;
+      this->hasLastHash = true;
+      if (duplicate) {
+        this->numSkipped++;
+        return this->writeI420();
+      }
+    }
+    this->yuv.resize(this->i420FrameSize());
+    rgbaToI420(rgba, this->width, this->height, this->bottomUp, this->bgraInput, this->yuv.data(),
+               0, 0, this->width, this->height);
+    return this->writeI420();
+  } else if (!this->bottomUp) {
+    ok = fwrite(rgba, rowBytes, this->height, this->file) == static_cast<size_t>(this->height);
+  } else {
+    for (int y = this->height - 1; ok && y >= 0; --y) {
+      ok = fwrite(rgba + y * rowBytes, 1, rowBytes, this->file) == rowBytes;
+    }
+  }
+  if (!ok) {
+    std::cerr << "Error writing frame" << std::endl;
+  }
+  return ok;
+}
+
+bool FrameStream::writeFrame(const uint8_t *rgba, const std::vector<PixelRect>& dirtyRegions)
+{
+  if (this->format != StreamFormat::Y4M || this->i420Input || this->yuv.size() != this->i420FrameSize()) {
+    return this->writeFrame(rgba);
+  }
+  if (!this->file) return false;
+
+  // The dirty regions already tell whether anything changed
+  this->hasLastHash = false;
+  if (dirtyRegions.empty()) this->numSkipped++;
+  for (const auto& rect : dirtyRegions) {
+    const int top = this->bottomUp ? this->height - rect.y - rect.height : rect.y;
+    rgbaToI420(rgba, this->width, this->height, this->bottomUp, this->bgraInput, this->yuv.data(),
+               rect.x, top, rect.x + rect.width, top + rect.height);
+  }
+  return this->writeI420();
+}
+
+bool FrameStream::writeI420()
+{
+  const bool ok = fputs("FRAME\n", this->file) >= 0 &&
+    fwrite(this->yuv.data(), 1, this->yuv.size(), this->file) == this->yuv.size();
+  if (!ok) {
+    std::cerr << "Error writing frame" << std::endl;
+  }
+  return ok;
+}
+
+bool FrameStream::close()
+{
+  if (!this->file) return true;
+  const bool ok = this->ownsFile ? fclose(this->file) == 0 : fflush(this->file) == 0;
+  this->file = nullptr;
+  return ok;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "FrameSink.h"
+#include "PixelBuffer.h"
+
+enum class StreamFormat {
+  Y4M,  // YUV4MPEG2, 4:2:0 BT.601
+  RGBA, // Headerless RGBA frames, back to back
+};
+
+// Parses a stream format name ("y4m", "raw", "rgba"). Returns false if unknown.
+bool parseStreamFormat(const std::string& name, StreamFormat& format);
+
+// Writes a sequence of frames to a file, FIFO or stdout.
+class FrameStream : public FrameSink
+{
+  FILE *file;
+  bool ownsFile;
+  int width;
+  int height;
+  StreamFormat format;
+  bool bottomUp;
+  PixelBuffer frame;
+  std::vector<uint8_t> yuv;  // Conversion buffer, holds the last frame
+  bool i420Input = false;
+  bool bgraInput = false;
+  bool skipDuplicates = false;
+  bool hasLastHash = false;
+  uint64_t lastHash = 0;
+  size_t numSkipped = 0;
+
+  bool writeI420();
+
+public:
+  FrameStream(FILE *file, bool ownsFile, int width, int height, StreamFormat format, bool bottomUp);
+  ~FrameStream() { close(); }
+  bool writeHeader(unsigned int fps);
+  bool writeFrame(const uint8_t *rgba);
+  // Only reconverts dirtyRegions for Y4M, keeping the rest of the previous frame
+  bool writeFrame(const uint8_t *rgba, const std::vector<PixelRect>& dirtyRegions);
+  // Y4M only: frames are already converted to top-down I420 (e.g. on the GPU), write them as is
+  void setI420Input(bool i420) { this->i420Input = i420; }
+  // Y4M only: frames come in BGRA order, as some drivers prefer to read back
+  void setBGRAInput(bool bgra) { this->bgraInput = bgra; }
+  // Y4M only: repeat the last converted frame when the input hashes the same
+  void setSkipDuplicates(bool skip) { this->skipDuplicates = skip; }
+  size_t framesSkipped() const override { return this->numSkipped; }
+  size_t i420FrameSize() const;
+  bool close();
+
+  PixelBuffer& acquireBuffer() override { return this->frame; }
+  bool submitFrame(PixelBuffer& buffer) override { return this->writeFrame(buffer.data()); }
+  bool submitFrame(PixelBuffer& buffer, const std::vector<PixelRect>& dirtyRegions) override {
+    return this->writeFrame(buffer.data(), dirtyRegions);
+  }
+  bool finish() override { return this->close(); }
+};
+
+// path "-" means stdout. bottomUp tells whether frames come in OpenGL row order.
+std::unique_ptr<FrameStream> createFrameStream(const std::string& path, int width, int height,
+                                               StreamFormat format, unsigned int fps, bool bottomUp);
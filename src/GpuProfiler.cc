@@ -0,0 +1,278 @@
+#include "GpuProfiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+thread_local GpuProfiler *activeGpuProfiler = nullptr;
+
+std::unique_ptr<GpuProfiler> createGpuProfiler(const OpenGLContext& ctx) {
+  if (ctx.isGLES()) {
+#ifdef USE_GLAD
+    if (hasGLExtension(GL_EXT_disjoint_timer_query)) {
+      return std::make_unique<GpuProfiler>(/*useEXT*/ true, 0, false);
+    }
+#endif
+    std::cerr << "GPU timer queries need GL_EXT_disjoint_timer_query" << std::endl;
+    return nullptr;
+  }
+  // Timer queries are core in OpenGL 3.3
+  if (ctx.majorVersion() < 3 || (ctx.majorVersion() == 3 && ctx.minorVersion() < 3)) {
+    if (!hasGLExtension(GL_ARB_timer_query)) {
+      std::cerr << "GPU timer queries need OpenGL 3.3 or GL_ARB_timer_query" << std::endl;
+      return nullptr;
+    }
+  }
+  // Without pipeline statistics, count primitives leaving the vertex stages instead of entering them
+  const bool hasStatistics = hasGLExtension(GL_ARB_pipeline_statistics_query);
+  const GLenum primitivesTarget = hasStatistics ? GL_PRIMITIVES_SUBMITTED_ARB
+    : ctx.majorVersion() >= 3 ? GL_PRIMITIVES_GENERATED : 0;
+  return std::make_unique<GpuProfiler>(/*useEXT*/ false, primitivesTarget, hasStatistics);
+}
+
+GpuProfiler::GpuProfiler(bool useEXT, GLenum primitivesTarget, bool countFragments)
+  : useEXT(useEXT), primitivesTarget(primitivesTarget), countFragments(countFragments) {
+  this->frames.name = "Frame";
+}
+
+GpuProfiler::~GpuProfiler()
+{
+  std::vector<GLuint> queries;
+  for (const auto& [target, ids] : this->freeQueries) {
+    queries.insert(queries.end(), ids.begin(), ids.end());
+  }
+  for (const auto& query : this->pending) {
+    for (GLuint id : {query.timeQuery, query.primitivesQuery, query.fragmentsQuery}) {
+      if (id) queries.push_back(id);
+    }
+  }
+  if (queries.empty()) return;
+#ifdef USE_GLAD
+  if (this->useEXT) {
+    GL_CHECK(glDeleteQueriesEXT(queries.size(), queries.data()));
+    return;
+  }
+#endif
+  GL_CHECK(glDeleteQueries(queries.size(), queries.data()));
+}
+
+GLenum GpuProfiler::timeTarget() const
+{
+  return this->useEXT ? GL_TIME_ELAPSED_EXT : GL_TIME_ELAPSED;
+}
+
+GLuint GpuProfiler::newQuery(GLenum target)
+{
+  auto& queries = this->freeQueries[target];
+  if (!queries.empty()) {
+    const GLuint query = queries.back();
+    queries.pop_back();
+    return query;
+  }
+  GLuint query = 0;
+#ifdef USE_GLAD
+  if (this->useEXT) {
+    GL_CHECK(glGenQueriesEXT(1, &query));
+    return query;
+  }
+#endif
+  GL_CHECK(glGenQueries(1, &query));
+  return query;
+}
+
+void GpuProfiler::releaseQuery(GLenum target, GLuint query)
+{
+  this->freeQueries[target].push_back(query);
+}
+
+void GpuProfiler::beginQuery(GLenum target, GLuint query)
+{
+#ifdef USE_GLAD
+  if (this->useEXT) {
+    GL_CHECK(glBeginQueryEXT(target, query));
+    return;
+  }
+#endif
+  GL_CHECK(glBeginQuery(target, query));
+}
+
+void GpuProfiler::endQuery(GLenum target)
+{
+#ifdef USE_GLAD
+  if (this->useEXT) {
+    GL_CHECK(glEndQueryEXT(target));
+    return;
+  }
+#endif
+  GL_CHECK(glEndQuery(target));
+}
+
+bool GpuProfiler::isAvailable(GLuint query)
+{
+  GLuint available = GL_FALSE;
+#ifdef USE_GLAD
+  if (this->useEXT) {
+    GL_CHECK(glGetQueryObjectuivEXT(query, GL_QUERY_RESULT_AVAILABLE_EXT, &available));
+    return available == GL_TRUE;
+  }
+#endif
+  GL_CHECK(glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available));
+  return available == GL_TRUE;
+}
+
+uint64_t GpuProfiler::result(GLuint query)
+{
+  GLuint64 value = 0;
+#ifdef USE_GLAD
+  if (this->useEXT) {
+    GL_CHECK(glGetQueryObjectui64vEXT(query, GL_QUERY_RESULT_EXT, &value));
+    return value;
+  }
+#endif
+  GL_CHECK(glGetQueryObjectui64v(query, GL_QUERY_RESULT, &value));
+  return value;
+}
+
+void GpuProfiler::beginPass(const char *name)
+{
+  if (this->depth++ > 0) return;
+
+  int pass = 0;
+  while (pass < static_cast<int>(this->passes.size()) && this->passes[pass].name != name) pass++;
+  if (pass == static_cast<int>(this->passes.size())) {
+    this->passes.emplace_back();
+    this->passes.back().name = name;
+  }
+
+  this->current = {pass, newQuery(timeTarget()), 0, 0};
+  beginQuery(timeTarget(), this->current.timeQuery);
+  if (this->primitivesTarget) {
+    this->current.primitivesQuery = newQuery(this->primitivesTarget);
+    beginQuery(this->primitivesTarget, this->current.primitivesQuery);
+  }
+  if (this->countFragments) {
+    this->current.fragmentsQuery = newQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+    beginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, this->current.fragmentsQuery);
+  }
+}
+
+void GpuProfiler::endPass()
+{
+  if (--this->depth > 0) return;
+
+  endQuery(timeTarget());
+  if (this->current.primitivesQuery) endQuery(this->primitivesTarget);
+  if (this->current.fragmentsQuery) endQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+  this->pending.push_back(this->current);
+}
+
+void GpuProfiler::markFrame()
+{
+  const GLuint query = newQuery(GL_TIMESTAMP);
+#ifdef USE_GLAD
+  if (this->useEXT) {
+    GL_CHECK(glQueryCounterEXT(query, GL_TIMESTAMP_EXT));
+  } else
+#endif
+  {
+    GL_CHECK(glQueryCounter(query, GL_TIMESTAMP));
+  }
+  this->pending.push_back({-1, query, 0, 0});
+
+  while (collectOne(/*wait*/ false)) {}
+}
+
+void GpuProfiler::finish()
+{
+  while (collectOne(/*wait*/ true)) {}
+}
+
+bool GpuProfiler::collectOne(bool wait)
+{
+  if (this->pending.empty()) return false;
+  const auto query = this->pending.front();
+  // Results become available in order, so only the oldest needs checking
+  if (!wait) {
+    for (GLuint id : {query.timeQuery, query.primitivesQuery, query.fragmentsQuery}) {
+      if (id && !isAvailable(id)) return false;
+    }
+  }
+  this->pending.pop_front();
+
+  bool disjoint = false;
+#ifdef USE_GLAD
+  if (this->useEXT) {
+    // The GPU changed clocks or was interrupted, so timings in flight are meaningless
+    GLint gpuDisjoint = 0;
+    GL_CHECK(glGetIntegerv(GL_GPU_DISJOINT_EXT, &gpuDisjoint));
+    disjoint = gpuDisjoint != 0;
+  }
+#endif
+  const uint64_t time = result(query.timeQuery);
+  releaseQuery(query.pass < 0 ? GL_TIMESTAMP : timeTarget(), query.timeQuery);
+
+  if (query.pass < 0) {
+    if (disjoint) {
+      this->disjointResults++;
+      this->lastTimestamp = 0;
+    } else {
+      if (this->lastTimestamp != 0 && time > this->lastTimestamp) {
+        const uint64_t elapsed = time - this->lastTimestamp;
+        this->frames.count++;
+        this->frames.totalNs += elapsed;
+        this->frames.maxNs = std::max(this->frames.maxNs, elapsed);
+      }
+      this->lastTimestamp = time;
+    }
+    return true;
+  }
+
+  // Counters are averaged over the same passes as times
+  const uint64_t primitives = query.primitivesQuery ? result(query.primitivesQuery) : 0;
+  const uint64_t fragments = query.fragmentsQuery ? result(query.fragmentsQuery) : 0;
+  if (query.primitivesQuery) releaseQuery(this->primitivesTarget, query.primitivesQuery);
+  if (query.fragmentsQuery) releaseQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, query.fragmentsQuery);
+
+  auto& pass = this->passes[query.pass];
+  if (disjoint) {
+    this->disjointResults++;
+    return true;
+  }
+  pass.count++;
+  pass.totalNs += time;
+  pass.maxNs = std::max(pass.maxNs, time);
+  pass.primitives += primitives;
+  pass.fragments += fragments;
+  return true;
+}
+
+void GpuProfiler::print(std::ostream& os) const
+{
+  const auto oldFlags = os.flags();
+  const auto oldPrecision = os.precision();
+  os << std::fixed << std::setprecision(3);
+  os << "GPU timings:\n";
+  os << "  " << std::left << std::setw(12) << "Pass" << std::right << std::setw(8) << "Count"
+     << std::setw(12) << "Total ms" << std::setw(12) << "Avg ms" << std::setw(12) << "Max ms";
+  if (this->primitivesTarget) os << std::setw(14) << "Prims/pass";
+  if (this->countFragments) os << std::setw(14) << "Frags/pass";
+  os << "\n";
+
+  const auto printRow = [&](const PassStats& pass, bool counters) {
+    if (pass.count == 0) return;
+    os << "  " << std::left << std::setw(12) << pass.name << std::right << std::setw(8) << pass.count
+       << std::setw(12) << pass.totalNs / 1e6 << std::setw(12) << pass.totalNs / 1e6 / pass.count
+       << std::setw(12) << pass.maxNs / 1e6;
+    if (counters && this->primitivesTarget) os << std::setw(14) << pass.primitives / pass.count;
+    if (counters && this->countFragments) os << std::setw(14) << pass.fragments / pass.count;
+    os << "\n";
+  };
+  for (const auto& pass : this->passes) printRow(pass, true);
+  printRow(this->frames, false);
+  if (this->disjointResults > 0) {
+    os << "  Discarded " << this->disjointResults << " results measured across GPU disjoint events\n";
+  }
+  os << std::flush;
+  os.flags(oldFlags);
+  os.precision(oldPrecision);
+}
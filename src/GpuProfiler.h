@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "system-gl.h"
+#include "OpenGLContext.h"
+
+// Measures the GPU time of each pass with GL_TIME_ELAPSED queries, and counts primitives and
+// fragment shader invocations where GL_ARB_pipeline_statistics_query is available.
+// Queries are only read once GL_QUERY_RESULT_AVAILABLE says so, usually a few frames later,
+// so profiling never stalls the pipeline. Passes are timed by GpuPass scopes.
+class GpuProfiler
+{
+public:
+  struct PassStats {
+    std::string name;
+    uint64_t count = 0;
+    uint64_t totalNs = 0;
+    uint64_t maxNs = 0;
+    uint64_t primitives = 0;
+    uint64_t fragments = 0;
+  };
+
+private:
+  struct PendingQuery {
+    int pass;  // Index into passes, or -1 for a frame timestamp
+    GLuint timeQuery;
+    GLuint primitivesQuery;
+    GLuint fragmentsQuery;
+  };
+
+  bool useEXT;  // GLES with GL_EXT_disjoint_timer_query
+  GLenum primitivesTarget;  // 0 if primitives can't be counted
+  bool countFragments;
+  std::vector<PassStats> passes;
+  std::deque<PendingQuery> pending;
+  // Finished queries by target, a query can't be reused with another target
+  std::map<GLenum, std::vector<GLuint>> freeQueries;
+  // The pass being timed. Time queries can't nest, so passes within it count towards it.
+  PendingQuery current;
+  int depth = 0;
+  // GPU time between frame timestamps
+  PassStats frames;
+  uint64_t lastTimestamp = 0;
+  uint64_t disjointResults = 0;
+
+  GLuint newQuery(GLenum target);
+  void releaseQuery(GLenum target, GLuint query);
+  GLenum timeTarget() const;
+  void beginQuery(GLenum target, GLuint query);
+  void endQuery(GLenum target);
+  bool isAvailable(GLuint query);
+  uint64_t result(GLuint query);
+  // Reads the oldest pending results, returns false if they aren't ready yet
+  bool collectOne(bool wait);
+
+public:
+  GpuProfiler(bool useEXT, GLenum primitivesTarget, bool countFragments);
+  ~GpuProfiler();
+  void beginPass(const char *name);
+  void endPass();
+  // Marks a frame boundary with a timestamp and collects the results that have arrived since
+  void markFrame();
+  // Waits for all outstanding results
+  void finish();
+  void print(std::ostream& os) const;
+};
+
+// Creates a profiler for the current context, or nullptr if it has no timer queries
+std::unique_ptr<GpuProfiler> createGpuProfiler(const OpenGLContext& ctx);
+
+// The profiler GpuPass scopes on this thread report to, nullptr for none
+extern thread_local GpuProfiler *activeGpuProfiler;
+
+// Times its scope as a pass of the active profiler, if any
+class GpuPass
+{
+  GpuProfiler *profiler;
+
+public:
+  explicit GpuPass(const char *name) : profiler(activeGpuProfiler) {
+    if (this->profiler) this->profiler->beginPass(name);
+  }
+  ~GpuPass() {
+    if (this->profiler) this->profiler->endPass();
+  }
+};
@@ -0,0 +1,171 @@
+#include "ImageSequenceSink.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+
+#include "frame_hash.h"
+
+bool isImageSequencePattern(const std::string& pattern)
+{
+  int numConversions = 0;
+  for (size_t i = 0; i < pattern.size(); ++i) {
+    if (pattern[i] != '%') continue;
+    if (i + 1 < pattern.size() && pattern[i + 1] == '%') {
+      ++i;
+      continue;
+    }
+    size_t j = i + 1;
+    while (j < pattern.size() && isdigit(pattern[j])) ++j;
+    if (j == pattern.size() || pattern[j] != 'd') return false;
+    numConversions++;
+    i = j;
+  }
+  return numConversions == 1;
+}
+
+ImageSequenceSink::ImageSequenceSink(const std::string& pattern, int width, int height, const OutputOptions& options,
+                                     unsigned int numThreads, size_t numBuffers)
+  : pattern(pattern), width(width), height(height), options(options), buffers(std::max<size_t>(numBuffers, 1))
+{
+  for (auto& buffer : this->buffers) {
+    buffer.resize(4 * static_cast<size_t>(width) * height);
+    this->freeBuffers.push_back(&buffer);
+  }
+  for (unsigned int i = 0; i < std::max(numThreads, 1u); ++i) {
+    this->threads.emplace_back(&ImageSequenceSink::writerLoop, this);
+  }
+}
+
+PixelBuffer& ImageSequenceSink::acquireBuffer()
+{
+  std::unique_lock lock(this->mutex);
+  this->bufferFreed.wait(lock, [this]() { return !this->freeBuffers.empty(); });
+  auto *buffer = this->freeBuffers.back();
+  this->freeBuffers.pop_back();
+  return *buffer;
+}
+
+bool ImageSequenceSink::submitFrame(PixelBuffer& buffer)
+{
+  std::vector<char> filename(this->pattern.size() + 32);
+  snprintf(filename.data(), filename.size(), this->pattern.c_str(), this->nextFrame++);
+
+  bool duplicate = false;
+  if (this->skipDuplicates) {
+    const uint64_t hash = hashFrame(buffer.data(), buffer.size());
+    duplicate = this->hasLastHash && hash == this->lastHash;
+    this->lastHash = hash;
+    this->hasLastHash = true;
+  }
+
+  Link link;
+  bool linkNow = false;
+  {
+    std::unique_lock lock(this->mutex);
+    if (this->numFailed > 0) {
+      lock.unlock();
+      this->releaseBuffer(buffer);
+      return false;
+    }
+    if (!duplicate) {
+      this->jobs.push_back({&buffer, filename.data()});
+      this->lastDistinct = filename.data();
+      this->lastDistinctWritten = false;
+    } else {
+      this->numSkipped++;
+      link = {this->lastDistinct, filename.data()};
+      // Otherwise the writer creates the link once the target is on disk
+      linkNow = this->lastDistinctWritten;
+      if (!linkNow) this->pendingLinks.push_back(link);
+    }
+  }
+  if (duplicate) {
+    this->releaseBuffer(buffer);
+    return !linkNow || this->createLink(link);
+  }
+  this->jobQueued.notify_one();
+  return true;
+}
+
+void ImageSequenceSink::releaseBuffer(PixelBuffer& buffer)
+{
+  {
+    std::lock_guard lock(this->mutex);
+    this->freeBuffers.push_back(&buffer);
+  }
+  this->bufferFreed.notify_one();
+}
+
+bool ImageSequenceSink::createLink(const Link& link)
+{
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  fs::remove(link.filename, ec);
+  fs::create_hard_link(link.target, link.filename, ec);
+  if (ec) {
+    // e.g. on file systems without hard links
+    fs::copy_file(link.target, link.filename, ec);
+  }
+  std::lock_guard lock(this->mutex);
+  if (ec) {
+    std::cerr << "Unable to link " << link.filename << " to " << link.target << ": " << ec.message() << std::endl;
+    this->numFailed++;
+    return false;
+  }
+  this->numWritten++;
+  return true;
+}
+
+void ImageSequenceSink::writerLoop()
+{
+  while (true) {
+    Job job;
+    {
+      std::unique_lock lock(this->mutex);
+      this->jobQueued.wait(lock, [this]() { return this->stopping || !this->jobs.empty(); });
+      if (this->jobs.empty()) return;
+      job = this->jobs.front();
+      this->jobs.pop_front();
+    }
+
+    const bool ok = writeImage(job.filename.c_str(), this->width, this->height, job.buffer->data(), this->options);
+
+    std::vector<Link> links;
+    {
+      std::lock_guard lock(this->mutex);
+      if (ok) this->numWritten++;
+      else this->numFailed++;
+      this->freeBuffers.push_back(job.buffer);
+      if (job.filename == this->lastDistinct) this->lastDistinctWritten = true;
+      const auto waiting = std::stable_partition(this->pendingLinks.begin(), this->pendingLinks.end(),
+                                                 [&job](const Link& link) { return link.target != job.filename; });
+      links.assign(waiting, this->pendingLinks.end());
+      this->pendingLinks.erase(waiting, this->pendingLinks.end());
+    }
+    this->bufferFreed.notify_one();
+    for (const auto& link : links) {
+      if (ok) {
+        this->createLink(link);
+      } else {
+        std::lock_guard lock(this->mutex);
+        this->numFailed++;
+      }
+    }
+  }
+}
+
+bool ImageSequenceSink::finish()
+{
+  if (this->threads.empty()) return this->numFailed == 0;
+  {
+    std::lock_guard lock(this->mutex);
+    this->stopping = true;
+  }
+  this->jobQueued.notify_all();
+  for (auto& thread : this->threads) thread.join();
+  this->threads.clear();
+  return this->numFailed == 0;
+}
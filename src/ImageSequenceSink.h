@@ -0,0 +1,72 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FrameSink.h"
+#include "PixelBuffer.h"
+#include "image_writers.h"
+
+// Returns true if pattern contains exactly one printf-style frame number (e.g. "out_%04d.png")
+bool isImageSequencePattern(const std::string& pattern);
+
+// Writes frames as numbered image files on background threads.
+// Frames are read back into a fixed pool of buffers which are recycled once written.
+// acquireBuffer() blocks while all of them are queued or being written, which bounds
+// memory and holds back the render loop when the disk can't keep up.
+class ImageSequenceSink : public FrameSink
+{
+  struct Job {
+    PixelBuffer *buffer;
+    std::string filename;
+  };
+  struct Link {
+    std::string target;
+    std::string filename;
+  };
+
+  std::string pattern;
+  int width;
+  int height;
+  OutputOptions options;
+  unsigned int nextFrame = 0;
+
+  std::vector<PixelBuffer> buffers;
+  std::vector<PixelBuffer *> freeBuffers;
+  std::deque<Job> jobs;
+  std::mutex mutex;
+  std::condition_variable bufferFreed;
+  std::condition_variable jobQueued;
+  std::vector<std::thread> threads;
+  bool stopping = false;
+  size_t numWritten = 0;
+  size_t numFailed = 0;
+
+  // Duplicate frames become hard links to the last distinct frame, once that has been written
+  bool skipDuplicates = false;
+  bool hasLastHash = false;
+  uint64_t lastHash = 0;
+  std::string lastDistinct;
+  bool lastDistinctWritten = false;
+  std::vector<Link> pendingLinks;
+  size_t numSkipped = 0;
+
+  void writerLoop();
+  bool createLink(const Link& link);
+
+public:
+  ImageSequenceSink(const std::string& pattern, int width, int height, const OutputOptions& options,
+                    unsigned int numThreads, size_t numBuffers);
+  ~ImageSequenceSink() { finish(); }
+  PixelBuffer& acquireBuffer() override;
+  bool submitFrame(PixelBuffer& buffer) override;
+  void releaseBuffer(PixelBuffer& buffer) override;
+  bool finish() override;
+  size_t framesWritten() const { return this->numWritten; }
+  size_t framesSkipped() const override { return this->numSkipped; }
+  void setSkipDuplicates(bool skip) { this->skipDuplicates = skip; }
+};
@@ -0,0 +1,64 @@
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Values below 2^subBucketBits get a bucket each, every power of two above is split in half as many
+constexpr int subBucketBits = 8;
+constexpr uint64_t subBucketCount = uint64_t{1} << subBucketBits;
+constexpr uint64_t subBucketHalf = subBucketCount / 2;
+
+int highestBit(uint64_t value) {
+  int bit = 0;
+  while (value >>= 1) bit++;
+  return bit;
+}
+
+}  // namespace
+
+size_t LatencyHistogram::bucketIndex(uint64_t ns)
+{
+  if (ns < subBucketCount) return ns;
+  // Keep the top subBucketBits bits, the highest of which is always set
+  const int shift = highestBit(ns) - subBucketBits + 1;
+  return subBucketCount + (shift - 1) * subBucketHalf + ((ns >> shift) - subBucketHalf);
+}
+
+uint64_t LatencyHistogram::bucketMax(size_t index)
+{
+  if (index < subBucketCount) return index;
+  const int shift = static_cast<int>((index - subBucketCount) / subBucketHalf) + 1;
+  const uint64_t top = subBucketHalf + (index - subBucketCount) % subBucketHalf;
+  return ((top + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+  const size_t index = bucketIndex(ns);
+  if (index >= this->buckets.size()) this->buckets.resize(index + 1);
+  this->buckets[index]++;
+  this->minNs = this->numValues == 0 ? ns : std::min(this->minNs, ns);
+  this->maxNs = std::max(this->maxNs, ns);
+  this->totalNs += ns;
+  this->numValues++;
+}
+
+double LatencyHistogram::mean() const
+{
+  return this->numValues > 0 ? static_cast<double>(this->totalNs) / this->numValues : 0.0;
+}
+
+uint64_t LatencyHistogram::percentile(double percent) const
+{
+  if (this->numValues == 0) return 0;
+  const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(percent / 100.0 * this->numValues)));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < this->buckets.size(); i++) {
+    seen += this->buckets[i];
+    // The bucket's upper edge can overshoot the largest value actually recorded
+    if (seen >= rank) return std::min(bucketMax(i), this->maxNs);
+  }
+  return this->maxNs;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Records durations in nanoseconds into logarithmic buckets, HdrHistogram style: each power of two
+// is split into 128 linear sub-buckets, so percentiles are within 1% of the recorded value, whatever
+// its magnitude, in a few KB. Min, max and mean are exact.
+class LatencyHistogram
+{
+  std::vector<uint64_t> buckets;
+  uint64_t numValues = 0;
+  uint64_t totalNs = 0;
+  uint64_t minNs = 0;
+  uint64_t maxNs = 0;
+
+  static size_t bucketIndex(uint64_t ns);
+  // The largest value counted into a bucket
+  static uint64_t bucketMax(size_t index);
+
+public:
+  void record(uint64_t ns);
+  uint64_t count() const { return this->numValues; }
+  uint64_t min() const { return this->minNs; }
+  uint64_t max() const { return this->maxNs; }
+  double mean() const;
+  // The value that percent of the recorded values are at or below, e.g. percentile(99)
+  uint64_t percentile(double percent) const;
+};
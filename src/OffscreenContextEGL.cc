@@ -2,6 +2,9 @@
 
 #include <fcntl.h>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <set>
 #include <vector>
@@ -10,6 +13,7 @@
 #endif
 #include "glad/egl.h"
 #include "GL/gl.h"
+#include "phase_timings.h"
 
 namespace {
 
@@ -38,96 +42,282 @@ const char* eglGetErrorString( EGLint error )
 }
 #undef CASE_STR
 
-} // namespace
-
-class OffscreenContextEGL : public OffscreenContext {
-
-public:
-  EGLDisplay eglDisplay;
-  EGLSurface eglSurface;
-  EGLContext eglContext;
+std::set<std::string> parseExtensions(const char *extensionString) {
+  std::set<std::string> extensions;
+  std::istringstream iss(extensionString ? extensionString : "");
+  std::string extension;
+  while (iss >> extension) {
+    extensions.insert(extension);
+  }
+  return extensions;
+}
 
-// If eglDisplay is backed by a GBM device.
+// An initialized display, kept for the lifetime of the process
+struct DisplayInfo {
+  EGLDisplay display = EGL_NO_DISPLAY;
+  // If display is backed by a GBM device.
   struct gbm_device *gbmDevice = nullptr;
+  std::set<std::string> extensions;
+  // eglChooseConfig() results by attribute list
+  std::map<std::vector<EGLint>, EGLConfig> configs;
 
-  OffscreenContextEGL(int width, int height) : OffscreenContext(width, height) {}
-  
-  bool makeCurrent() override {
-    eglMakeCurrent(this->eglDisplay, this->eglSurface, this->eglSurface, this->eglContext);
-    return true;
+  bool hasExtension(const std::string& name) const {
+    return this->extensions.find(name) != this->extensions.end();
   }
-  bool destroy() override {
+};
+
+// Process-wide cache of EGL displays, so that only the first context per GPU loads EGL,
+// enumerates devices and initializes the display.
+// GPUs are picked by EGL device index ("0", "1", ...) or by DRM node (e.g. /dev/dri/renderD128, using GBM).
+// An empty GPU takes the first device, falling back to the surfaceless and default displays.
+class DisplayRegistry {
+  std::mutex mutex;
+  bool loaded = false;
+  std::set<std::string> clientExtensions;
+  std::vector<EGLDeviceEXT> devices;
+  std::map<std::string, std::unique_ptr<DisplayInfo>> displays;
+
+  bool load() {
+    if (this->loaded) return true;
+    PhaseTimer timer("EGL library load");
+    int initialEglVersion = gladLoaderLoadEGL(NULL);
+    if (!initialEglVersion) {
+      std::cerr << "gladLoaderLoadEGL(NULL): Unable to load EGL" << std::endl;
+      return false;
+    }
+    std::cout << "Loaded EGL " << GLAD_VERSION_MAJOR(initialEglVersion) << "."
+      << GLAD_VERSION_MINOR(initialEglVersion) << " on first load." << std::endl;
+
+    const char *ext = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    std::cout << (ext ? ext : "") << std::endl;
+    this->clientExtensions = parseExtensions(ext);
+
+    if (this->clientExtensions.count("EGL_EXT_platform_device") && eglQueryDevicesEXT) {
+      EGLint numDevices = 0;
+      if (eglQueryDevicesEXT(0, nullptr, &numDevices) && numDevices > 0) {
+        this->devices.resize(numDevices);
+        eglQueryDevicesEXT(numDevices, this->devices.data(), &numDevices);
+        this->devices.resize(numDevices);
+      }
+    }
+    this->loaded = true;
     return true;
   }
 
 #ifdef HAS_GBM
-  void getDisplayFromDrmNode(const std::string& drmNode) {
-    this->eglDisplay = EGL_NO_DISPLAY;
+  EGLDisplay getDisplayFromDrmNode(const std::string& drmNode, DisplayInfo& info) {
     const int fd = open(drmNode.c_str(), O_RDWR);
     if (fd < 0) {
       std::cerr << "Unable to open DRM node " << drmNode << std::endl;
-      return;
+      return EGL_NO_DISPLAY;
     }
 
-    this->gbmDevice = gbm_create_device(fd);
-    if (!this->gbmDevice) {
+    info.gbmDevice = gbm_create_device(fd);
+    if (!info.gbmDevice) {
       std::cerr << "Unable to create GDM device" << std::endl;
-      return;
+      return EGL_NO_DISPLAY;
     }
 
     // FIXME: Check EGL extension before passing the identifier to this function
-    this->eglDisplay = eglGetPlatformDisplay(EGL_PLATFORM_GBM_KHR, this->gbmDevice, nullptr);
+    return eglGetPlatformDisplay(EGL_PLATFORM_GBM_KHR, info.gbmDevice, nullptr);
   }
 #endif
 
-  void findPlatformDisplay() {
-    std::set<std::string> clientExtensions;
-    std::string ext = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
-    std::cout << ext << std::endl;
-    std::istringstream iss(ext);
-    while (iss) {
-      std::string extension;
-      iss >> extension;
-      clientExtensions.insert(extension);
+  EGLDisplay getDeviceDisplay(size_t index) {
+    if (index >= this->devices.size() || !eglGetPlatformDisplayEXT) {
+      std::cerr << "EGL device " << index << " not found (" << this->devices.size() << " devices)" << std::endl;
+      return EGL_NO_DISPLAY;
     }
+    std::cout << "Trying Platform display " << index << "..." << std::endl;
+    // FIXME: Attribs
+    return eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, this->devices[index], nullptr);
+  }
 
-    if (clientExtensions.find("EGL_EXT_platform_device") == clientExtensions.end()) {
-      return;
+  EGLDisplay findDisplay() {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    if (!this->devices.empty()) {
+      display = getDeviceDisplay(0);
+    }
+    // Mesa's platform without any window system or device, e.g. for llvmpipe
+    if (display == EGL_NO_DISPLAY && eglGetPlatformDisplayEXT &&
+        this->clientExtensions.count("EGL_MESA_platform_surfaceless")) {
+      std::cout << "Trying surfaceless platform display..." << std::endl;
+      display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    }
+    // FIXME: Should we try default display first?
+    // If so, we also have to try initializing it
+    if (display == EGL_NO_DISPLAY) {
+      std::cout << "Trying default EGL display..." << std::endl;
+      display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
     }
+    return display;
+  }
 
-    std::cout << "Trying Platform display..." << std::endl;
-    if (eglQueryDevicesEXT && eglGetPlatformDisplayEXT) {
-      EGLDeviceEXT eglDevice;
-      EGLint numDevices = 0;
-      eglQueryDevicesEXT(1, &eglDevice, &numDevices);
-      if (numDevices > 0) {
-      // FIXME: Attribs
-        this->eglDisplay =  eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, eglDevice, nullptr);
+public:
+  static DisplayRegistry& instance() {
+    static DisplayRegistry registry;
+    return registry;
+  }
+
+  // Returns nullptr if the display can't be found or initialized
+  DisplayInfo *display(const std::string& gpu) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto it = this->displays.find(gpu);
+    if (it != this->displays.end()) return it->second.get();
+    if (!load()) return nullptr;
+
+    auto info = std::make_unique<DisplayInfo>();
+    PhaseTimer lookupTimer("EGL display lookup");
+    if (gpu.empty()) {
+      info->display = findDisplay();
+    } else if (gpu.find_first_not_of("0123456789") == std::string::npos) {
+      info->display = getDeviceDisplay(std::stoul(gpu));
+    } else {
+#ifdef HAS_GBM
+      std::cout << "Using GBM..." << std::endl;
+      info->display = getDisplayFromDrmNode(gpu, *info);
+#else
+      std::cerr << "Selecting a GPU by DRM node needs GBM support" << std::endl;
+#endif
+    }
+    lookupTimer.stop();
+    if (info->display == EGL_NO_DISPLAY) {
+      std::cerr << "No EGL display found" << std::endl;
+      return nullptr;
+    }
+
+    PhaseTimer initializeTimer("eglInitialize");
+    EGLint major, minor;
+    if (!eglInitialize(info->display, &major, &minor)) {
+      std::cerr << "Unable to initialize EGL: " << eglGetErrorString(eglGetError()) << std::endl;
+      return nullptr;
+    }
+    initializeTimer.stop();
+
+    std::cout << "EGL Version: " << major << "." << minor << " (" << eglQueryString(info->display, EGL_VENDOR) << ")" << std::endl;
+
+    PhaseTimer reloadTimer("EGL library reload");
+    const auto eglVersion = gladLoaderLoadEGL(info->display);
+    if (!eglVersion) {
+      std::cerr << "gladLoaderLoadEGL(eglDisplay): Unable to reload EGL" << std::endl;
+      return nullptr;
+    }
+    std::cout << "Loaded EGL " << GLAD_VERSION_MAJOR(eglVersion) << "." << GLAD_VERSION_MINOR(eglVersion) << " after reload" << std::endl;
+
+    if (eglGetDisplayDriverName) {
+      const char *name = eglGetDisplayDriverName(info->display);
+      if (name) {
+        std::cout << "Got EGL display with driver name: " << name << std::endl;
       }
     }
+    reloadTimer.stop();
+    info->extensions = parseExtensions(eglQueryString(info->display, EGL_EXTENSIONS));
+
+    DisplayInfo *result = info.get();
+    this->displays[gpu] = std::move(info);
+    return result;
+  }
+
+  bool chooseConfig(DisplayInfo& info, const std::vector<EGLint>& attribs, EGLConfig& config) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto it = info.configs.find(attribs);
+    if (it != info.configs.end()) {
+      config = it->second;
+      return true;
+    }
+    PhaseTimer timer("EGL config choice");
+    EGLint numConfigs;
+    bool gotConfig = eglChooseConfig(info.display, attribs.data(), &config, 1, &numConfigs);
+    if (!gotConfig || numConfigs == 0) {
+      std::cerr << "Failed to choose config (eglError: " << std::hex << eglGetError() << ")" << std::endl;
+      return false;
+    }
+    info.configs[attribs] = config;
+    return true;
+  }
+};
+
+} // namespace
+
+class OffscreenContextEGL : public OffscreenContext {
+
+public:
+  EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+  EGLSurface eglSurface = EGL_NO_SURFACE;
+  EGLContext eglContext = EGL_NO_CONTEXT;
+  // Kept to create contexts sharing this one
+  EGLConfig eglConfig;
+  std::vector<EGLint> contextAttribs;
+  // The bound API is per thread
+  EGLenum eglAPI = EGL_OPENGL_API;
+  // Rendering goes to FBOs, so the context only needs a surface if EGL_KHR_surfaceless_context is missing
+  bool surfaceless = false;
+
+// If eglDisplay is backed by a GBM device.
+  struct gbm_device *gbmDevice = nullptr;
+  // Backs eglSurface on GBM devices without EGL_KHR_surfaceless_context
+  struct gbm_surface *gbmSurface = nullptr;
+  // Owned by DisplayRegistry
+  DisplayInfo *displayInfo = nullptr;
+
+  OffscreenContextEGL(int width, int height) : OffscreenContext(width, height) {}
+  
+  bool makeCurrent() override {
+    eglBindAPI(this->eglAPI);
+    eglMakeCurrent(this->eglDisplay, this->eglSurface, this->eglSurface, this->eglContext);
+    return true;
+  }
+  bool releaseCurrent() override {
+    eglBindAPI(this->eglAPI);
+    return eglMakeCurrent(this->eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  }
+  bool destroy() override {
+    // Otherwise EGL would only delete the context once it is released
+    eglBindAPI(this->eglAPI);
+    if (this->eglContext != EGL_NO_CONTEXT && eglGetCurrentContext() == this->eglContext) this->releaseCurrent();
+    bool ok = true;
+    if (this->eglSurface != EGL_NO_SURFACE) {
+      ok = eglDestroySurface(this->eglDisplay, this->eglSurface) && ok;
+      this->eglSurface = EGL_NO_SURFACE;
+    }
+#ifdef HAS_GBM
+    if (this->gbmSurface) {
+      gbm_surface_destroy(this->gbmSurface);
+      this->gbmSurface = nullptr;
+    }
+#endif
+    if (this->eglContext != EGL_NO_CONTEXT) {
+      ok = eglDestroyContext(this->eglDisplay, this->eglContext) && ok;
+      this->eglContext = EGL_NO_CONTEXT;
+    }
+    if (!ok) std::cerr << "Unable to destroy EGL context (eglError: " << eglGetError() << ")" << std::endl;
+    return ok;
   }
 
-  void createSurface(const EGLConfig& config,size_t width, size_t height) {
-    if (this->gbmDevice) {
+  // Only needed to make the context current, as rendering goes to FBOs
+  void createSurface(const EGLConfig& config) {
+    if (this->surfaceless) {
+      this->eglSurface = EGL_NO_SURFACE;
+    } else if (this->gbmDevice) {
 #ifdef HAS_GBM
 // FIXME: For some reason, we have to pass 0 as flags for the nvidia GBM backend
-      const auto gbmSurface =
-        gbm_surface_create(this->gbmDevice, width, height,
+      this->gbmSurface =
+        gbm_surface_create(this->gbmDevice, 1, 1,
                            GBM_FORMAT_ARGB8888, 
                            0); // GBM_BO_USE_RENDERING
-      if (!gbmSurface) {
+      if (!this->gbmSurface) {
         std::cerr << "Unable to create GBM surface" << std::endl;
         this->eglSurface = EGL_NO_SURFACE;
         return;
       }
 
       this->eglSurface =
-        eglCreatePlatformWindowSurface(this->eglDisplay, config, gbmSurface, nullptr);
+        eglCreatePlatformWindowSurface(this->eglDisplay, config, this->gbmSurface, nullptr);
 #endif
     } else {
       const EGLint pbufferAttribs[] = {
-        EGL_WIDTH, static_cast<EGLint>(width),
-        EGL_HEIGHT, static_cast<EGLint>(height),
+        EGL_WIDTH, 1,
+        EGL_HEIGHT, 1,
         EGL_NONE,
       };
       this->eglSurface = eglCreatePbufferSurface(this->eglDisplay, config, pbufferAttribs);
@@ -145,24 +335,23 @@ std::shared_ptr<OffscreenContext> CreateOffscreenContextEGL(size_t width, size_t
 {
   auto ctx = std::make_shared<OffscreenContextEGL>(width, height);
 
-  int initialEglVersion = gladLoaderLoadEGL(NULL);
-  if (!initialEglVersion) {
-    std::cerr << "gladLoaderLoadEGL(NULL): Unable to load EGL" << std::endl;
+  ctx->displayInfo = DisplayRegistry::instance().display(drmNode);
+  if (!ctx->displayInfo) {
     return nullptr;
   }
-  std::cout << "Loaded EGL " << GLAD_VERSION_MAJOR(initialEglVersion) << "."
-    << GLAD_VERSION_MINOR(initialEglVersion) << " on first load." << std::endl;
-  
+  ctx->eglDisplay = ctx->displayInfo->display;
+  ctx->gbmDevice = ctx->displayInfo->gbmDevice;
+
   EGLint conformant;
   if (!gles) conformant = EGL_OPENGL_BIT;
   else if (majorGLVersion >= 3) conformant = EGL_OPENGL_ES3_BIT;
   else if (majorGLVersion >= 2) conformant = EGL_OPENGL_ES2_BIT;
   else conformant = EGL_OPENGL_ES_BIT;
 
-  const EGLint configAttribs[] = {
+  const std::vector<EGLint> configAttribs = {
     // For some reason, we have to request a "window" surface when using GBM, although
     // we're rendering offscreen
-    EGL_SURFACE_TYPE, drmNode.empty() ? EGL_PBUFFER_BIT : EGL_WINDOW_BIT,
+    EGL_SURFACE_TYPE, ctx->gbmDevice ? EGL_WINDOW_BIT : EGL_PBUFFER_BIT,
     EGL_BLUE_SIZE, 8,
     EGL_GREEN_SIZE, 8,
     EGL_RED_SIZE, 8,
@@ -174,65 +363,26 @@ std::shared_ptr<OffscreenContext> CreateOffscreenContextEGL(size_t width, size_t
     EGL_NONE
   };
 
-  if (!drmNode.empty()) {
-#ifdef HAS_GBM
-    std::cout << "Using GBM..." << std::endl;
-    ctx->getDisplayFromDrmNode(drmNode);
-#endif
-  } else {
-    // FIXME: Should we try default display first?
-    // If so, we also have to try initializing it
-    ctx->findPlatformDisplay();
-    if (ctx->eglDisplay == EGL_NO_DISPLAY) {
-      std::cout << "Trying default EGL display..." << std::endl;
-      ctx->eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
-    }
-  }
-
-  if (ctx->eglDisplay == EGL_NO_DISPLAY) {
-    std::cerr << "No EGL display found" << std::endl;
-    return nullptr;
-  }
-
-  EGLint major, minor;
-  if (!eglInitialize(ctx->eglDisplay, &major, &minor)) {
-    std::cerr << "Unable to initialize EGL: " << eglGetErrorString(eglGetError()) << std::endl;
-    return nullptr;
-  }
-
-  std::cout << "EGL Version: " << major << "." << minor << " (" << eglQueryString(ctx->eglDisplay, EGL_VENDOR) << ")" << std::endl;
-
-  const auto eglVersion = gladLoaderLoadEGL(ctx->eglDisplay);
-  if (!eglVersion) {
-    std::cerr << "gladLoaderLoadEGL(eglDisplay): Unable to reload EGL" << std::endl;
-    return nullptr;
-  }
-  std::cout << "Loaded EGL " << GLAD_VERSION_MAJOR(eglVersion) << "." << GLAD_VERSION_MINOR(eglVersion) << " after reload" << std::endl;
-
-  if (eglGetDisplayDriverName) {
-    const char *name = eglGetDisplayDriverName(ctx->eglDisplay);
-    if (name) {
-      std::cout << "Got EGL display with driver name: " << name << std::endl;
-    }
-  }
-
-  EGLint numConfigs;
   EGLConfig config;
-  bool gotConfig = eglChooseConfig(ctx->eglDisplay, configAttribs, &config, 1, &numConfigs);
-  if (!gotConfig || numConfigs == 0) {
-    std::cerr << "Failed to choose config (eglError: " << std::hex << eglGetError() << ")" << std::endl;
+  if (!DisplayRegistry::instance().chooseConfig(*ctx->displayInfo, configAttribs, config)) {
     return nullptr;
   }
-  if (!eglBindAPI(gles ? EGL_OPENGL_ES_API : EGL_OPENGL_API)) {
+  ctx->eglAPI = gles ? EGL_OPENGL_ES_API : EGL_OPENGL_API;
+  if (!eglBindAPI(ctx->eglAPI)) {
     std::cerr << "eglBindAPI() failed!" << std::endl;
     return nullptr;
   }
 
-  ctx->createSurface(config, width, height);    
-  if (ctx->eglSurface == EGL_NO_SURFACE) {
+  ctx->surfaceless = ctx->displayInfo->hasExtension("EGL_KHR_surfaceless_context");
+  if (ctx->surfaceless) std::cout << "Using surfaceless context" << std::endl;
+  else std::cout << "Using 1x1 " << (ctx->gbmDevice ? "GBM" : "pbuffer") << " surface" << std::endl;
+  PhaseTimer surfaceTimer("EGL surface creation");
+  ctx->createSurface(config);    
+  if (ctx->eglSurface == EGL_NO_SURFACE && !ctx->surfaceless) {
     std::cerr << "Unable to create EGL surface (eglError: " << eglGetError() << ")" << std::endl;
     return nullptr;
   }
+  surfaceTimer.stop();
 
   std::vector<EGLint> ctxattr = {
     EGL_CONTEXT_MAJOR_VERSION, static_cast<EGLint>(majorGLVersion),
@@ -243,11 +393,46 @@ std::shared_ptr<OffscreenContext> CreateOffscreenContextEGL(size_t width, size_t
     ctxattr.push_back(compatibilityProfile ? EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT : EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT);
   }
   ctxattr.push_back(EGL_NONE);
+  PhaseTimer contextTimer("EGL context creation");
   ctx->eglContext = eglCreateContext(ctx->eglDisplay, config, EGL_NO_CONTEXT, ctxattr.data());
   if (ctx->eglContext == EGL_NO_CONTEXT) {
     std::cerr << "Unable to create EGL context (eglError: " << eglGetError() << ")" << std::endl;
     return nullptr;
   }
+  ctx->eglConfig = config;
+  ctx->contextAttribs = ctxattr;
 
   return ctx;
 }
+
+std::shared_ptr<OffscreenContext> CreateSharedOffscreenContextEGL(const std::shared_ptr<OpenGLContext>& share,
+                                                                  size_t width, size_t height)
+{
+  const auto shareEGL = std::dynamic_pointer_cast<OffscreenContextEGL>(share);
+  if (!shareEGL) {
+    std::cerr << "Shared contexts need an EGL context to share with" << std::endl;
+    return nullptr;
+  }
+  auto ctx = std::make_shared<OffscreenContextEGL>(width, height);
+  ctx->eglDisplay = shareEGL->eglDisplay;
+  ctx->gbmDevice = shareEGL->gbmDevice;
+  ctx->displayInfo = shareEGL->displayInfo;
+  ctx->eglConfig = shareEGL->eglConfig;
+  ctx->contextAttribs = shareEGL->contextAttribs;
+  ctx->eglAPI = shareEGL->eglAPI;
+  ctx->surfaceless = shareEGL->surfaceless;
+  ctx->setVersion(share->majorVersion(), share->minorVersion(), share->isGLES());
+
+  ctx->createSurface(ctx->eglConfig);
+  if (ctx->eglSurface == EGL_NO_SURFACE && !ctx->surfaceless) {
+    std::cerr << "Unable to create EGL surface (eglError: " << eglGetError() << ")" << std::endl;
+    return nullptr;
+  }
+  ctx->eglContext = eglCreateContext(ctx->eglDisplay, ctx->eglConfig, shareEGL->eglContext,
+                                     ctx->contextAttribs.data());
+  if (ctx->eglContext == EGL_NO_CONTEXT) {
+    std::cerr << "Unable to create shared EGL context (eglError: " << eglGetError() << ")" << std::endl;
+    return nullptr;
+  }
+  return ctx;
+}
@@ -9,3 +9,8 @@ std::shared_ptr<OffscreenContext> CreateOffscreenContextEGL(
     size_t width, size_t height, size_t majorGLVersion, 
     size_t minorGLVersion, bool gles, bool compatibilityProfile,
     const std::string& drmNode = "");
+
+// Creates a context on the same display and config as share, sharing its programs, buffers and textures.
+// Returns nullptr if share isn't an EGL context.
+std::shared_ptr<OffscreenContext> CreateSharedOffscreenContextEGL(
+    const std::shared_ptr<OpenGLContext>& share, size_t width, size_t height);
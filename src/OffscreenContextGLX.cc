@@ -6,6 +6,7 @@
 #include <iostream>
 
 #include "scope_guard.hpp"
+#include "phase_timings.h"
 
 namespace {
 
@@ -63,6 +64,7 @@ public:
       if (fbconfigs) XFree(fbconfigs);
       if (visinfo)XFree(visinfo);
     });
+    PhaseTimer configTimer("GLX config choice");
       fbconfigs = glXChooseFBConfig(this->display, DefaultScreen(this->display), attributes, &numConfigs);
     if (fbconfigs == nullptr) {
       std::cerr << "glXChooseFBConfig() failed" << std::endl;
@@ -73,6 +75,9 @@ public:
       std::cerr << "glXGetVisualFromFBConfig failed" << std::endl;
       return false;
     }
+    configTimer.stop();
+
+    PhaseTimer windowTimer("GLX window creation");
 
     // We can't depend on XCreateWindow() returning 0 on failure, so we use a custom Xlib error handler
     XErrorHandler originalErrorHandler = XSetErrorHandler(xlibErrorHandler);
@@ -97,8 +102,9 @@ public:
       std::cerr << "XCreateWindow() failed: " << description << std::endl;
       return false;
     }
+    windowTimer.stop();
 
-
+    PhaseTimer contextTimer("GLX context creation");
     GLint context_attributes[] = {
       GLX_CONTEXT_MAJOR_VERSION_ARB, static_cast<GLint>(majorGLVersion),
       GLX_CONTEXT_MINOR_VERSION_ARB, static_cast<GLint>(minorGLVersion),
@@ -139,6 +145,7 @@ std::shared_ptr<OffscreenContext> CreateOffscreenContextGLX(size_t width, size_t
 {
   auto ctx = std::make_shared<OffscreenContextGLX>(width, height);
 
+  PhaseTimer displayTimer("X display connection");
   ctx->display = XOpenDisplay(nullptr);
   if (ctx->display == nullptr) {
     std::cerr << "Unable to open a connection to the X server." << std::endl;
@@ -146,7 +153,9 @@ std::shared_ptr<OffscreenContext> CreateOffscreenContextGLX(size_t width, size_t
     std::cerr << "DISPLAY=" << (dpyenv?dpyenv:"") << std::endl;
     return nullptr;
   }
+  displayTimer.stop();
 
+  PhaseTimer loadTimer("GLX library load");
   int glxVersion = gladLoaderLoadGLX(ctx->display, DefaultScreen(ctx->display));
   if (!glxVersion) {
       std::cerr << "GLAD: Unable to load GLX" << std::endl;
@@ -154,6 +163,7 @@ std::shared_ptr<OffscreenContext> CreateOffscreenContextGLX(size_t width, size_t
   }
   int glxMajor = GLAD_VERSION_MAJOR(glxVersion);
   int glxMinor = GLAD_VERSION_MINOR(glxVersion);
+  loadTimer.stop();
   std::cout << "GLAD: Loaded GLX " << glxMajor << "." << glxMinor << std::endl;
 
   // We require GLX >= 1.3.
@@ -0,0 +1,52 @@
+#include "OffscreenContextPool.h"
+
+#include <iostream>
+#include <thread>
+
+#include "OffscreenContext.h"
+
+#ifdef HAS_EGL
+#include "OffscreenContextEGL.h"
+#endif
+
+OffscreenContextPool::~OffscreenContextPool()
+{
+  for (size_t i = 1; i < this->contexts.size(); ++i) {
+    if (const auto offscreen = std::dynamic_pointer_cast<OffscreenContext>(this->contexts[i])) offscreen->destroy();
+  }
+}
+
+void OffscreenContextPool::run(const std::function<void(OpenGLContext&)>& work)
+{
+  std::vector<std::thread> threads;
+  for (const auto& ctx : this->contexts) {
+    threads.emplace_back([&work, ctx]() {
+      ctx->makeCurrent();
+      work(*ctx);
+      ctx->releaseCurrent();
+    });
+  }
+  for (auto& thread : threads) thread.join();
+}
+
+std::unique_ptr<OffscreenContextPool> createOffscreenContextPool(const std::string& provider,
+                                                                 const std::shared_ptr<OpenGLContext>& ctx,
+                                                                 unsigned int numContexts)
+{
+  std::vector<std::shared_ptr<OpenGLContext>> contexts = {ctx};
+#ifdef HAS_EGL
+  if (provider == "egl") {
+    while (contexts.size() < numContexts) {
+      auto shared = CreateSharedOffscreenContextEGL(ctx, ctx->width(), ctx->height());
+      if (!shared) {
+        for (size_t i = 1; i < contexts.size(); ++i) std::static_pointer_cast<OffscreenContext>(contexts[i])->destroy();
+        return nullptr;
+      }
+      contexts.push_back(shared);
+    }
+    return std::make_unique<OffscreenContextPool>(std::move(contexts));
+  }
+#endif
+  std::cerr << "Context provider '" << provider << "' can't create shared contexts" << std::endl;
+  return nullptr;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "OpenGLContext.h"
+
+// Offscreen contexts in one share group, so programs, buffers and textures created in one of them
+// can be used in all. Framebuffers and vertex arrays aren't shared, each context needs its own.
+class OffscreenContextPool
+{
+  std::vector<std::shared_ptr<OpenGLContext>> contexts;
+
+public:
+  explicit OffscreenContextPool(std::vector<std::shared_ptr<OpenGLContext>> contexts)
+    : contexts(std::move(contexts)) {}
+  // Destroys the contexts the pool created, i.e. all but the first
+  ~OffscreenContextPool();
+  size_t size() const { return this->contexts.size(); }
+  const std::shared_ptr<OpenGLContext>& context(size_t index) const { return this->contexts[index]; }
+  // Calls work on one thread per context, with that context current, and waits for all of them.
+  // None of the contexts may be current on another thread meanwhile.
+  void run(const std::function<void(OpenGLContext&)>& work);
+};
+
+// Creates a pool of numContexts contexts: ctx, followed by contexts sharing with it.
+// Only EGL can share contexts so far; returns nullptr for other providers.
+std::unique_ptr<OffscreenContextPool> createOffscreenContextPool(const std::string& provider,
+                                                                 const std::shared_ptr<OpenGLContext>& ctx,
+                                                                 unsigned int numContexts);
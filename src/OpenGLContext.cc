@@ -1,14 +1,92 @@
 #include "OpenGLContext.h"
 
+#include <cstring>
 #include <iostream>
 
 #include "system-gl.h"
+#include "GpuProfiler.h"
+#include "pixel_convert.h"
+
+void OpenGLContext::queryReadFormat()
+{
+  // GLES always has the query. On desktop it came with ARB_ES2_compatibility (core in 4.1).
+  const bool hasQuery = this->gles_ || this->major_ > 4 || (this->major_ == 4 && this->minor_ >= 1) ||
+    hasGLExtension(GL_ARB_ES2_compatibility);
+  this->readBGRA_ = false;
+  if (!hasQuery) return;
+
+  GLint format = 0;
+  GLint type = 0;
+  glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_FORMAT, &format);
+  glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_TYPE, &type);
+  if (glGetError() != GL_NO_ERROR) return;
+  // GL_UNSIGNED_INT_8_8_8_8_REV has the same memory layout as bytes on little-endian hosts
+  this->readBGRA_ = format == GL_BGRA &&
+    (type == GL_UNSIGNED_BYTE || type == GL_UNSIGNED_INT_8_8_8_8_REV);
+}
+
+bool OpenGLContext::readPixels(const PixelRect& rect, uint8_t *data, int rowLength, bool convertToRGBA) const
+{
+  if (rect.x < 0 || rect.y < 0 || rect.width <= 0 || rect.height <= 0 ||
+      rect.x + rect.width > this->width_ || rect.y + rect.height > this->height_) {
+    std::cerr << "Readback region " << rect.x << "," << rect.y << " " << rect.width << "x" << rect.height
+              << " outside of " << this->width_ << "x" << this->height_ << " framebuffer" << std::endl;
+    return false;
+  }
+  if (rowLength == 0) rowLength = rect.width;
+  const GLenum format = this->readBGRA_ ? GL_BGRA : GL_RGBA;
+  const size_t stride = 4 * static_cast<size_t>(rowLength);
+
+  GpuPass pass("Readback");
+  if (rowLength == rect.width) {
+    GL_CHECK(glReadPixels(rect.x, rect.y, rect.width, rect.height, format, GL_UNSIGNED_BYTE, data));
+  } else if (!this->gles_ || this->major_ >= 3) {
+    GL_CHECK(glPixelStorei(GL_PACK_ROW_LENGTH, rowLength));
+    GL_CHECK(glReadPixels(rect.x, rect.y, rect.width, rect.height, format, GL_UNSIGNED_BYTE, data));
+    GL_CHECK(glPixelStorei(GL_PACK_ROW_LENGTH, 0));
+  } else {
+    // GLES 2 has no GL_PACK_ROW_LENGTH
+    std::vector<uint8_t> tight(4 * static_cast<size_t>(rect.width) * rect.height);
+    GL_CHECK(glReadPixels(rect.x, rect.y, rect.width, rect.height, format, GL_UNSIGNED_BYTE, tight.data()));
+    for (int row = 0; row < rect.height; ++row) {
+      memcpy(data + row * stride, tight.data() + row * 4 * static_cast<size_t>(rect.width), 4 * rect.width);
+    }
+  }
+
+  if (this->readBGRA_ && convertToRGBA) {
+    if (rowLength == rect.width) {
+      swizzleRB(data, data, static_cast<size_t>(rect.width) * rect.height);
+    } else {
+      for (int row = 0; row < rect.height; ++row) swizzleRB(data + row * stride, data + row * stride, rect.width);
+    }
+  }
+  return true;
+}
+
+bool OpenGLContext::getFramebuffer(uint8_t *data, size_t size, bool convertToRGBA) const
+{
+  if (size < this->framebufferSize()) {
+    std::cerr << "Framebuffer readback needs " << this->framebufferSize() << " bytes, got " << size << std::endl;
+    return false;
+  }
+  return this->readPixels({0, 0, this->width_, this->height_}, data, 0, convertToRGBA);
+}
+
+bool OpenGLContext::getFramebuffer(PixelBuffer& buffer, bool convertToRGBA) const
+{
+  buffer.resize(this->framebufferSize());
+  return this->getFramebuffer(buffer.data(), buffer.size(), convertToRGBA);
+}
+
+bool OpenGLContext::getFramebuffer(const PixelRect& rect, PixelBuffer& buffer, bool convertToRGBA) const
+{
+  buffer.resize(4 * static_cast<size_t>(rect.width) * rect.height);
+  return this->readPixels(rect, buffer.data(), 0, convertToRGBA);
+}
 
 std::vector<uint8_t> OpenGLContext::getFramebuffer() const
 {
-  int samplesPerPixel = 4; // R, G, B and A
-  int rowBytes = samplesPerPixel * this->width_;
-  std::vector<uint8_t> buffer(rowBytes * this->height_);
-  GL_CHECK(glReadPixels(0, 0, this->width_, this->height_, GL_RGBA, GL_UNSIGNED_BYTE, buffer.data()));
-  return std::move(buffer);
+  std::vector<uint8_t> buffer(this->framebufferSize());
+  this->getFramebuffer(buffer.data(), buffer.size());
+  return buffer;
 }
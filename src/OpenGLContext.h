@@ -4,6 +4,8 @@
 #include <ostream>
 #include <vector>
 
+#include "PixelBuffer.h"
+
 class OpenGLContext {
  protected:
   int width_;
@@ -11,6 +13,7 @@ class OpenGLContext {
   int major_;
   int minor_;
   int gles_;
+  bool readBGRA_ = false;
 
  public:
   OpenGLContext(int width, int height) : width_(width), height_(height) {}
@@ -19,6 +22,11 @@ class OpenGLContext {
     this->minor_ = minor;
     this->gles_ = gles;
   }
+  // For when the FBO rendered into was resized, so readback covers all of it
+  void setFramebufferSize(int width, int height) {
+    this->width_ = width;
+    this->height_ = height;
+  }
   int width() const { return this->width_; }
   int height() const { return this->height_; }
   int majorVersion() const { return this->major_; }
@@ -26,5 +34,22 @@ class OpenGLContext {
   bool isGLES() const { return this->gles_; }
   virtual bool isOffscreen() const = 0;
   virtual bool makeCurrent() {return false;}
+  // Detaches the context from the calling thread, so another thread can make it current
+  virtual bool releaseCurrent() {return false;}
+  // Size in bytes of an RGBA readback of the whole framebuffer
+  size_t framebufferSize() const { return 4 * static_cast<size_t>(this->width_) * this->height_; }
+  // Asks the driver which format glReadPixels() prefers for the current read framebuffer,
+  // and reads back BGRA from then on if that is what it wants. Needs a current context.
+  void queryReadFormat();
+  bool readsBGRA() const { return this->readBGRA_; }
+  // Reads the framebuffer into caller-owned memory of at least framebufferSize() bytes.
+  // With convertToRGBA = false, the pixels are left in the order given by readsBGRA().
+  bool getFramebuffer(uint8_t *data, size_t size, bool convertToRGBA = true) const;
+  bool getFramebuffer(PixelBuffer& buffer, bool convertToRGBA = true) const;
+  // Reads a sub-rectangle, tightly packed
+  bool getFramebuffer(const PixelRect& rect, PixelBuffer& buffer, bool convertToRGBA = true) const;
+  // Reads a sub-rectangle into data, with rows rowLength pixels apart (0: rect.width).
+  // Used to patch regions of a larger image in place.
+  bool readPixels(const PixelRect& rect, uint8_t *data, int rowLength = 0, bool convertToRGBA = true) const;
   std::vector<uint8_t> getFramebuffer() const;
 };
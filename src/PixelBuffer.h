@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// A rectangle of pixels, in OpenGL window coordinates unless stated otherwise
+struct PixelRect {
+  int x = 0;
+  int y = 0;
+  int width = 0;
+  int height = 0;
+};
+
+// Reusable byte buffer for framebuffer readback.
+// Unlike std::vector, growing it doesn't zero-fill the new storage, and
+// shrinking it keeps the allocation around for the next frame.
+class PixelBuffer {
+  std::unique_ptr<uint8_t[]> data_;
+  size_t size_ = 0;
+  size_t capacity_ = 0;
+
+ public:
+  PixelBuffer() = default;
+  explicit PixelBuffer(size_t size) { resize(size); }
+  uint8_t *data() { return this->data_.get(); }
+  const uint8_t *data() const { return this->data_.get(); }
+  size_t size() const { return this->size_; }
+  size_t capacity() const { return this->capacity_; }
+  bool empty() const { return this->size_ == 0; }
+
+  // Contents are undefined after growing past capacity().
+  void resize(size_t size) {
+    if (size > this->capacity_) {
+      this->data_.reset(new uint8_t[size]);
+      this->capacity_ = size;
+    }
+    this->size_ = size;
+  }
+};
@@ -0,0 +1,34 @@
+#include "ProgramRegistry.h"
+
+#include "shader_cache.h"
+
+GLuint ProgramRegistry::shader(GLenum type, const char *source)
+{
+  const auto key = std::make_pair(type, std::string(source));
+  if (const auto it = this->shaders.find(key); it != this->shaders.end()) return it->second;
+  const GLuint shader = compileShader(type, source);
+  if (shader) this->shaders.emplace(key, shader);
+  return shader;
+}
+
+GLuint ProgramRegistry::program(const char *vertexSource, const char *fragmentSource,
+                                const std::vector<const char *>& attributes)
+{
+  std::vector<std::string> attributeNames;
+  for (const char *attribute : attributes) attributeNames.push_back(attribute ? attribute : "");
+  auto key = std::make_tuple(std::string(vertexSource), std::string(fragmentSource), std::move(attributeNames));
+  if (const auto it = this->programs.find(key); it != this->programs.end()) return it->second;
+
+  const GLuint program = linkProgram(vertexSource, fragmentSource, attributes,
+                                     [this](GLenum type, const char *source) { return shader(type, source); });
+  if (program) this->programs.emplace(std::move(key), program);
+  return program;
+}
+
+void ProgramRegistry::destroy()
+{
+  for (const auto& [key, program] : this->programs) glDeleteProgram(program);
+  for (const auto& [key, shader] : this->shaders) glDeleteShader(shader);
+  this->programs.clear();
+  this->shaders.clear();
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "system-gl.h"
+
+// Compiles each shader source once and links each combination of sources and attribute bindings
+// once, so scene objects drawn with the same shaders share a program. The GLSL version is part of
+// the source. Handles belong to the context they were created in and those sharing with it.
+class ProgramRegistry
+{
+  std::map<std::pair<GLenum, std::string>, GLuint> shaders;
+  std::map<std::tuple<std::string, std::string, std::vector<std::string>>, GLuint> programs;
+
+public:
+  // Returns the shader compiled from source, compiling it the first time. 0 on failure.
+  GLuint shader(GLenum type, const char *source);
+  // Returns the program linked from these sources, with attributes[i] bound to location i, linking
+  // (or loading from the shader cache) the first time. 0 on failure.
+  GLuint program(const char *vertexSource, const char *fragmentSource,
+                 const std::vector<const char *>& attributes = {});
+  size_t numShaders() const { return this->shaders.size(); }
+  size_t numPrograms() const { return this->programs.size(); }
+  // Deletes all shaders and programs. Needs the context current, so the destructor doesn't.
+  void destroy();
+};
@@ -0,0 +1,227 @@
+#include "RenderServer.h"
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+bool makeAddress(const std::string& path, sockaddr_un& address)
+{
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Invalid socket path \"" << path << "\"" << std::endl;
+    return false;
+  }
+  memcpy(address.sun_path, path.c_str(), path.size());
+  return true;
+}
+
+bool writeLine(int fd, const std::string& line)
+{
+  const std::string data = line + "\n";
+  size_t written = 0;
+  while (written < data.size()) {
+    const auto result = ::write(fd, data.data() + written, data.size() - written);
+    if (result < 0 && errno == EINTR) continue;
+    if (result <= 0) return false;
+    written += result;
+  }
+  return true;
+}
+
+// Reads up to the next newline, keeping anything after it in pending. Returns false on EOF or error.
+bool readLine(int fd, std::string& pending, std::string& line)
+{
+  while (true) {
+    const auto newline = pending.find('\n');
+    if (newline != std::string::npos) {
+      line = pending.substr(0, newline);
+      pending.erase(0, newline + 1);
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      return true;
+    }
+    char chunk[4096];
+    const auto result = ::read(fd, chunk, sizeof(chunk));
+    if (result < 0 && errno == EINTR) continue;
+    if (result <= 0) return false;
+    pending.append(chunk, result);
+  }
+}
+
+}  // namespace
+
+bool parseRenderRequest(const std::string& line, RenderRequest& request, std::string& error)
+{
+  std::istringstream stream(line);
+  std::string field;
+  while (stream >> field) {
+    const auto equals = field.find('=');
+    if (equals == std::string::npos) {
+      error = "expected key=value, got \"" + field + "\"";
+      return false;
+    }
+    const auto key = field.substr(0, equals);
+    const auto value = field.substr(equals + 1);
+    if (key == "width" || key == "height") {
+      char *end = nullptr;
+      const auto number = strtoul(value.c_str(), &end, 10);
+      // Sizes end up as GLsizei
+      if (value.empty() || *end != '\0' || number == 0 || number > INT_MAX) {
+        error = "invalid " + key + " \"" + value + "\"";
+        return false;
+      }
+      (key == "width" ? request.width : request.height) = number;
+    } else if (key == "mode") {
+      request.mode = value;
+    } else if (key == "out") {
+      request.out = value;
+    } else if (key == "format") {
+      request.format = value;
+    } else if (key == "alpha") {
+      request.alpha = value;
+    } else {
+      error = "unknown key \"" + key + "\"";
+      return false;
+    }
+  }
+  if (request.out.empty()) {
+    error = "missing out=<path>";
+    return false;
+  }
+  // Relative paths would resolve against the server's working directory, not the client's
+  if (request.out.front() != '/') {
+    error = "out must be an absolute path, got \"" + request.out + "\"";
+    return false;
+  }
+  return true;
+}
+
+std::string formatRenderRequest(const RenderRequest& request)
+{
+  std::ostringstream line;
+  if (request.width > 0) line << "width=" << request.width << " ";
+  if (request.height > 0) line << "height=" << request.height << " ";
+  if (!request.mode.empty()) line << "mode=" << request.mode << " ";
+  if (!request.format.empty()) line << "format=" << request.format << " ";
+  if (!request.alpha.empty()) line << "alpha=" << request.alpha << " ";
+  line << "out=" << request.out;
+  return line.str();
+}
+
+bool RenderServer::listen(const std::string& path)
+{
+  sockaddr_un address;
+  if (!makeAddress(path, address)) return false;
+
+  struct stat info;
+  if (lstat(path.c_str(), &info) == 0) {
+    if (!S_ISSOCK(info.st_mode)) {
+      std::cerr << path << " exists and isn't a socket" << std::endl;
+      return false;
+    }
+    unlink(path.c_str());
+  }
+
+  this->listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (this->listenFd < 0) {
+    std::cerr << "socket(): " << strerror(errno) << std::endl;
+    return false;
+  }
+  // Requests write files as this user, so only this user may connect. Created with the
+  // permissions already restricted, so there is no window in which others could.
+  const mode_t oldMask = umask(0177);
+  const bool bound = bind(this->listenFd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0;
+  umask(oldMask);
+  if (!bound || ::listen(this->listenFd, 16) != 0) {
+    std::cerr << "Unable to listen on " << path << ": " << strerror(errno) << std::endl;
+    this->close();
+    return false;
+  }
+  this->path = path;
+  return true;
+}
+
+bool RenderServer::serve(const std::function<bool(const RenderRequest&, std::string& error)>& handler)
+{
+  // Clients may hang up before reading their reply
+  signal(SIGPIPE, SIG_IGN);
+  while (true) {
+    const int fd = accept(this->listenFd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      std::cerr << "accept(): " << strerror(errno) << std::endl;
+      return false;
+    }
+    const bool keepServing = this->handleConnection(fd, handler);
+    ::close(fd);
+    if (!keepServing) return true;
+  }
+}
+
+// Returns false once asked to shut down
+bool RenderServer::handleConnection(int fd, const std::function<bool(const RenderRequest&, std::string&)>& handler)
+{
+  std::string pending;
+  std::string line;
+  while (readLine(fd, pending, line)) {
+    if (line.empty()) continue;
+    if (line == "shutdown") {
+      writeLine(fd, "ok");
+      return false;
+    }
+    RenderRequest request;
+    std::string error;
+    const auto start = std::chrono::steady_clock::now();
+    if (!parseRenderRequest(line, request, error) || !handler(request, error)) {
+      if (!writeLine(fd, "error " + error)) break;
+      continue;
+    }
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    std::ostringstream reply;
+    reply.precision(3);
+    reply << "ok " << elapsed.count();
+    if (!writeLine(fd, reply.str())) break;
+  }
+  return true;
+}
+
+void RenderServer::close()
+{
+  if (this->listenFd < 0) return;
+  ::close(this->listenFd);
+  this->listenFd = -1;
+  if (!this->path.empty()) unlink(this->path.c_str());
+  this->path.clear();
+}
+
+bool sendRenderRequest(const std::string& path, const std::string& line, std::string& reply)
+{
+  sockaddr_un address;
+  if (!makeAddress(path, address)) return false;
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    std::cerr << "socket(): " << strerror(errno) << std::endl;
+    return false;
+  }
+  if (connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+    std::cerr << "Unable to connect to " << path << ": " << strerror(errno) << std::endl;
+    ::close(fd);
+    return false;
+  }
+  std::string pending;
+  const bool replied = writeLine(fd, line) && readLine(fd, pending, reply);
+  ::close(fd);
+  if (!replied) std::cerr << "No reply from " << path << std::endl;
+  return replied;
+}
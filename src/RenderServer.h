@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// A render request, sent as one line of space-separated key=value pairs, e.g.
+// "width=256 height=256 mode=modern out=/tmp/thumb.png". Omitted values fall back to the server's options.
+struct RenderRequest {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::string mode;    // immediate | modern
+  std::string out;     // Absolute path, without whitespace
+  std::string format;  // As --format
+  std::string alpha;   // As --alpha
+};
+
+// Returns false and sets error if line isn't a valid request
+bool parseRenderRequest(const std::string& line, RenderRequest& request, std::string& error);
+std::string formatRenderRequest(const RenderRequest& request);
+
+// Answers render requests on a Unix domain socket, one connection and one request at a time.
+// Every request line gets a reply line: "ok <milliseconds>" or "error <message>".
+// The line "shutdown" stops the server.
+class RenderServer
+{
+  std::string path;
+  int listenFd = -1;
+
+  bool handleConnection(int fd, const std::function<bool(const RenderRequest&, std::string&)>& handler);
+
+public:
+  ~RenderServer() { close(); }
+  // Replaces a stale socket file at path, but nothing else. Only the current user may connect.
+  bool listen(const std::string& path);
+  // Calls handler for each request, which returns false and sets the error message if it failed.
+  // Returns when a client sends "shutdown".
+  bool serve(const std::function<bool(const RenderRequest&, std::string& error)>& handler);
+  void close();
+};
+
+// Sends line to the server listening at path and waits for its reply
+bool sendRenderRequest(const std::string& path, const std::string& line, std::string& reply);
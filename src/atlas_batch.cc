@@ -0,0 +1,72 @@
+#include "atlas_batch.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "system-gl.h"
+
+PixelRect AtlasLayout::cell(int index) const
+{
+  const int column = index % this->columns;
+  const int row = index / this->columns;
+  return {column * this->cellWidth, (this->rows - row - 1) * this->cellHeight, this->cellWidth, this->cellHeight};
+}
+
+AtlasLayout atlasLayout(int cellWidth, int cellHeight, unsigned int numJobs, int maxSize)
+{
+  AtlasLayout layout;
+  layout.cellWidth = cellWidth;
+  layout.cellHeight = cellHeight;
+  layout.columns = std::max(1, static_cast<int>(std::min<unsigned int>(numJobs, maxSize / cellWidth)));
+  const unsigned int neededRows = (numJobs + layout.columns - 1) / layout.columns;
+  layout.rows = std::max(1, static_cast<int>(std::min<unsigned int>(neededRows, maxSize / cellHeight)));
+  return layout;
+}
+
+bool renderAtlasBatch(const OpenGLContext& ctx, const AtlasLayout& layout, unsigned int numJobs,
+                      const std::function<void()>& renderJob, const std::function<void()>& finishAtlas,
+                      FrameSink& sink)
+{
+  const size_t cellRowBytes = 4 * static_cast<size_t>(layout.cellWidth);
+  const size_t atlasRowBytes = 4 * static_cast<size_t>(layout.width());
+  PixelBuffer atlas;
+  for (unsigned int first = 0; first < numJobs; first += layout.numCells()) {
+    const int numCells = static_cast<int>(std::min<unsigned int>(layout.numCells(), numJobs - first));
+    // glClear() ignores the viewport
+    GL_CHECK(glEnable(GL_SCISSOR_TEST));
+    for (int i = 0; i < numCells; ++i) {
+      const PixelRect cell = layout.cell(i);
+      GL_CHECK(glViewport(cell.x, cell.y, cell.width, cell.height));
+      GL_CHECK(glScissor(cell.x, cell.y, cell.width, cell.height));
+      renderJob();
+    }
+    // The scissor test applies to blits as well
+    GL_CHECK(glDisable(GL_SCISSOR_TEST));
+    finishAtlas();
+
+    // Only read the rows of cells which were rendered to, which are at the top
+    const int usedRows = (numCells + layout.columns - 1) / layout.columns;
+    const int readHeight = usedRows * layout.cellHeight;
+    const PixelRect readRect = {0, layout.height() - readHeight, layout.width(), readHeight};
+    if (!ctx.getFramebuffer(readRect, atlas)) {
+      std::cerr << "Unable to read back atlas" << std::endl;
+      return false;
+    }
+    for (int i = 0; i < numCells; ++i) {
+      const int row = i / layout.columns;
+      const int column = i % layout.columns;
+      auto& buffer = sink.acquireBuffer();
+      buffer.resize(cellRowBytes * layout.cellHeight);
+      // Flip the rows while copying, starting from the cell's top row
+      const uint8_t *src = atlas.data() + (readHeight - row * layout.cellHeight - 1) * atlasRowBytes +
+                           column * cellRowBytes;
+      for (int y = 0; y < layout.cellHeight; ++y) {
+        memcpy(buffer.data() + y * cellRowBytes, src - y * atlasRowBytes, cellRowBytes);
+      }
+      if (!sink.submitFrame(buffer)) return false;
+    }
+  }
+  GL_CHECK(glViewport(0, 0, layout.width(), layout.height()));
+  return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <functional>
+
+#include "FrameSink.h"
+#include "OpenGLContext.h"
+#include "PixelBuffer.h"
+
+// Grid of equally sized cells in one framebuffer, so many small images share a single readback
+struct AtlasLayout {
+  int cellWidth = 0;
+  int cellHeight = 0;
+  int columns = 1;
+  int rows = 1;
+
+  int width() const { return this->cellWidth * this->columns; }
+  int height() const { return this->cellHeight * this->rows; }
+  int numCells() const { return this->columns * this->rows; }
+  // Cells are numbered row by row from the top left, the rect is in OpenGL window coordinates
+  PixelRect cell(int index) const;
+};
+
+// Fits up to numJobs cells into maxSize x maxSize, but always at least one
+AtlasLayout atlasLayout(int cellWidth, int cellHeight, unsigned int numJobs, int maxSize);
+
+// Renders numJobs images into the cells of the current framebuffer, which must be layout's size,
+// and reads back each filled atlas at once, handing its cells to sink in order, top row first.
+// renderJob draws the scene into the viewport, which is scissored to the cell.
+// finishAtlas runs before each readback, e.g. to resolve a multisampled framebuffer.
+bool renderAtlasBatch(const OpenGLContext& ctx, const AtlasLayout& layout, unsigned int numJobs,
+                      const std::function<void()>& renderJob, const std::function<void()>& finishAtlas,
+                      FrameSink& sink);
@@ -0,0 +1,89 @@
+#include "frame_hash.h"
+
+#include <cstring>
+
+#ifdef HAS_XXHASH
+#include <xxhash.h>
+#endif
+
+namespace {
+
+constexpr uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t prime3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t read64(const uint8_t *p)
+{
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+inline uint64_t hashRound(uint64_t acc, uint64_t input)
+{
+  acc += input * prime2;
+  return rotl(acc, 31) * prime1;
+}
+
+inline uint64_t mergeRound(uint64_t acc, uint64_t value)
+{
+  acc ^= hashRound(0, value);
+  return acc * prime1 + prime4;
+}
+
+// Four independent lanes of 8 bytes each, so the multiplies pipeline
+uint64_t hashPortable(const uint8_t *data, size_t size)
+{
+  const uint8_t *p = data;
+  const uint8_t *end = data + size;
+  uint64_t h;
+  if (size >= 32) {
+    uint64_t v1 = prime1 + prime2;
+    uint64_t v2 = prime2;
+    uint64_t v3 = 0;
+    uint64_t v4 = 0 - prime1;
+    for (; p + 32 <= end; p += 32) {
+      v1 = hashRound(v1, read64(p));
+      v2 = hashRound(v2, read64(p + 8));
+      v3 = hashRound(v3, read64(p + 16));
+      v4 = hashRound(v4, read64(p + 24));
+    }
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = mergeRound(h, v1);
+    h = mergeRound(h, v2);
+    h = mergeRound(h, v3);
+    h = mergeRound(h, v4);
+  } else {
+    h = prime5;
+  }
+  h += size;
+  for (; p + 8 <= end; p += 8) {
+    h ^= hashRound(0, read64(p));
+    h = rotl(h, 27) * prime1 + prime4;
+  }
+  for (; p < end; ++p) {
+    h ^= *p * prime5;
+    h = rotl(h, 11) * prime1;
+  }
+  h ^= h >> 33;
+  h *= prime2;
+  h ^= h >> 29;
+  h *= prime3;
+  h ^= h >> 32;
+  return h;
+}
+
+} // namespace
+
+uint64_t hashFrame(const uint8_t *data, size_t size)
+{
+#ifdef HAS_XXHASH
+  return XXH3_64bits(data, size);
+#else
+  return hashPortable(data, size);
+#endif
+}
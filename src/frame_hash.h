@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Fast non-cryptographic 64-bit hash for spotting repeated frames.
+// Uses XXH3 when built with xxHash, otherwise a portable hash in the style of XXH64.
+// Values differ between the two, so don't persist them.
+uint64_t hashFrame(const uint8_t *data, size_t size);
@@ -0,0 +1,453 @@
+#include "image_writers.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#ifdef HAS_ZLIB
+#include "png_parallel.h"
+#endif
+#include "pixel_convert.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "ext/stb/stb_image_write.h"
+
+namespace {
+
+// Pixels to write: 4 samples (RGBA) as read back, or 3 (RGB) once alpha is dropped
+struct Image {
+  int width;
+  int height;
+  int samplesPerPixel;
+  const uint8_t *data;
+  bool bottomUp;
+
+  size_t rowBytes() const { return static_cast<size_t>(this->width) * this->samplesPerPixel; }
+  const uint8_t *row(int y) const {
+    return this->data + (this->bottomUp ? this->height - 1 - y : y) * this->rowBytes();
+  }
+};
+
+struct FormatName {
+  ImageFormat format;
+  const char *name;
+};
+
+struct AlphaModeName {
+  AlphaMode mode;
+  const char *name;
+};
+
+const AlphaModeName alphaModeNames[] = {
+  {AlphaMode::Keep, "keep"},
+  {AlphaMode::Drop, "drop"},
+  {AlphaMode::Premultiply, "premultiply"},
+  {AlphaMode::Unpremultiply, "unpremultiply"},
+};
+
+const FormatName formatNames[] = {
+  {ImageFormat::PNG, "png"},
+  {ImageFormat::RAW, "raw"},
+  {ImageFormat::RAW, "rgba"},
+  {ImageFormat::PPM, "ppm"},
+  {ImageFormat::PAM, "pam"},
+  {ImageFormat::QOI, "qoi"},
+};
+
+bool writeRows(FILE *f, const Image& image)
+{
+  const size_t rowBytes = image.rowBytes();
+  if (!image.bottomUp) {
+    return fwrite(image.data, rowBytes, image.height, f) == static_cast<size_t>(image.height);
+  }
+  for (int y = 0; y < image.height; ++y) {
+    if (fwrite(image.row(y), 1, rowBytes, f) != rowBytes) return false;
+  }
+  return true;
+}
+
+bool writeRGBRows(FILE *f, const Image& image)
+{
+  if (image.samplesPerPixel == 3) return writeRows(f, image);
+  std::vector<uint8_t> rgb(static_cast<size_t>(image.width) * 3);
+  for (int y = 0; y < image.height; ++y) {
+    rgbaToRGB(image.row(y), rgb.data(), image.width);
+    if (fwrite(rgb.data(), 1, rgb.size(), f) != rgb.size()) return false;
+  }
+  return true;
+}
+
+bool writeNetpbmHeader(FILE *f, ImageFormat format, int width, int height, int samplesPerPixel)
+{
+  if (format == ImageFormat::PPM) {
+    return fprintf(f, "P6\n%d %d\n255\n", width, height) > 0;
+  }
+  return fprintf(f, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n", width, height,
+                 samplesPerPixel, samplesPerPixel == 3 ? "RGB" : "RGB_ALPHA") > 0;
+}
+
+// Applies the alpha mode to a row of RGBA pixels. dst holds 3 samples per pixel if alpha is dropped.
+void convertAlphaRow(const uint8_t *src, uint8_t *dst, int width, AlphaMode alpha)
+{
+  switch (alpha) {
+  case AlphaMode::Drop:
+    rgbaToRGB(src, dst, width);
+    break;
+  case AlphaMode::Premultiply:
+    premultiplyAlpha(src, dst, width);
+    break;
+  case AlphaMode::Unpremultiply:
+    unpremultiplyAlpha(src, dst, width);
+    break;
+  default:
+    memcpy(dst, src, 4 * static_cast<size_t>(width));
+    break;
+  }
+}
+
+// Applies the alpha mode to RGBA rows, into a top-down image
+std::vector<uint8_t> convertAlpha(const Image& image, AlphaMode alpha)
+{
+  const int samplesPerPixel = alpha == AlphaMode::Drop ? 3 : 4;
+  const size_t outRowBytes = static_cast<size_t>(image.width) * samplesPerPixel;
+  std::vector<uint8_t> out(outRowBytes * image.height);
+  for (int y = 0; y < image.height; ++y) {
+    convertAlphaRow(image.row(y), out.data() + y * outRowBytes, image.width, alpha);
+  }
+  return out;
+}
+
+// See https://qoiformat.org/qoi-specification.pdf
+// Encodes an image row by row; runs and the color index carry over from one row to the next.
+class QOIEncoder
+{
+  static constexpr uint8_t QOI_OP_INDEX = 0x00;
+  static constexpr uint8_t QOI_OP_DIFF = 0x40;
+  static constexpr uint8_t QOI_OP_LUMA = 0x80;
+  static constexpr uint8_t QOI_OP_RUN = 0xc0;
+  static constexpr uint8_t QOI_OP_RGB = 0xfe;
+  static constexpr uint8_t QOI_OP_RGBA = 0xff;
+
+  int channels;
+  uint8_t index[64][4] = {};
+  uint8_t prev[4] = {0, 0, 0, 255};
+  int run = 0;
+
+public:
+  explicit QOIEncoder(int channels) : channels(channels) {}
+
+  void writeHeader(int width, int height, std::vector<uint8_t>& out) const
+  {
+    const auto put32 = [&out](uint32_t value) {
+      out.push_back(value >> 24);
+      out.push_back(value >> 16);
+      out.push_back(value >> 8);
+      out.push_back(value);
+    };
+    out.insert(out.end(), {'q', 'o', 'i', 'f'});
+    put32(width);
+    put32(height);
+    out.push_back(this->channels);
+    out.push_back(0); // sRGB with linear alpha
+  }
+
+  void encodeRow(const uint8_t *row, int width, std::vector<uint8_t>& out)
+  {
+    for (int x = 0; x < width; ++x) {
+      const uint8_t *sample = row + this->channels * x;
+      const uint8_t px[4] = {sample[0], sample[1], sample[2], this->channels == 4 ? sample[3] : uint8_t(255)};
+      if (memcmp(px, this->prev, 4) == 0) {
+        this->run++;
+        if (this->run == 62) {
+          out.push_back(QOI_OP_RUN | (this->run - 1));
+          this->run = 0;
+        }
+        continue;
+      }
+      if (this->run > 0) {
+        out.push_back(QOI_OP_RUN | (this->run - 1));
+        this->run = 0;
+      }
+
+      const int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+      if (memcmp(this->index[hash], px, 4) == 0) {
+        out.push_back(QOI_OP_INDEX | hash);
+      } else {
+        memcpy(this->index[hash], px, 4);
+        if (px[3] == this->prev[3]) {
+          const int8_t vr = px[0] - this->prev[0];
+          const int8_t vg = px[1] - this->prev[1];
+          const int8_t vb = px[2] - this->prev[2];
+          const int8_t vgr = vr - vg;
+          const int8_t vgb = vb - vg;
+          if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+            out.push_back(QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+          } else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8) {
+            out.push_back(QOI_OP_LUMA | (vg + 32));
+            out.push_back((vgr + 8) << 4 | (vgb + 8));
+          } else {
+            out.insert(out.end(), {QOI_OP_RGB, px[0], px[1], px[2]});
+          }
+        } else {
+          out.insert(out.end(), {QOI_OP_RGBA, px[0], px[1], px[2], px[3]});
+        }
+      }
+      memcpy(this->prev, px, 4);
+    }
+  }
+
+  void finish(std::vector<uint8_t>& out)
+  {
+    if (this->run > 0) out.push_back(QOI_OP_RUN | (this->run - 1));
+    this->run = 0;
+    out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+  }
+};
+
+std::vector<uint8_t> encodeQOI(const Image& image)
+{
+  std::vector<uint8_t> out;
+  out.reserve(14 + static_cast<size_t>(image.width) * image.height * (image.samplesPerPixel + 1) + 8);
+  QOIEncoder encoder(image.samplesPerPixel);
+  encoder.writeHeader(image.width, image.height, out);
+  for (int y = 0; y < image.height; ++y) {
+    encoder.encodeRow(image.row(y), image.width, out);
+  }
+  encoder.finish(out);
+  return out;
+}
+
+bool writePNG(const char *filename, const Image& image, const OutputOptions& options)
+{
+#ifdef HAS_ZLIB
+  if (options.pngThreads > 0) {
+    return writePNGParallel(filename, image.width, image.height, image.samplesPerPixel, image.data,
+                            image.bottomUp, options.pngThreads);
+  }
+#endif
+  stbi_flip_vertically_on_write(image.bottomUp);
+  if (stbi_write_png(filename, image.width, image.height, image.samplesPerPixel, image.data, 0) != 1) {
+    std::cerr << "stbi_write_png(\"" << filename << "\") failed" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Writes RAW, PPM, PAM and QOI directly, PNG through PNGStreamWriter
+class FileRowWriter : public ImageRowWriter
+{
+  std::string filename;
+  FILE *file = nullptr;
+  int width;
+  int height;
+  OutputOptions options;
+  int samplesPerPixel;
+  int rowsLeft;
+  QOIEncoder qoi;
+#ifdef HAS_ZLIB
+  PNGStreamWriter png;
+#endif
+  std::vector<uint8_t> converted;
+  std::vector<uint8_t> encoded;
+
+public:
+  FileRowWriter(const char *filename, int width, int height, const OutputOptions& options)
+    : filename(filename), width(width), height(height), options(options),
+      samplesPerPixel(options.alpha == AlphaMode::Drop ? 3 : 4), rowsLeft(height), qoi(samplesPerPixel) {}
+  ~FileRowWriter() override {
+    if (this->file) fclose(this->file);
+  }
+
+  bool open()
+  {
+    if (this->options.format == ImageFormat::PNG) {
+#ifdef HAS_ZLIB
+      return this->png.open(this->filename.c_str(), this->width, this->height, this->samplesPerPixel);
+#else
+      std::cerr << "Writing PNG images row by row needs zlib" << std::endl;
+      return false;
+#endif
+    }
+    this->file = fopen(this->filename.c_str(), "wb");
+    if (!this->file) {
+      std::cerr << "Unable to open " << this->filename << " for writing" << std::endl;
+      return false;
+    }
+    bool ok = true;
+    switch (this->options.format) {
+    case ImageFormat::PPM:
+    case ImageFormat::PAM:
+      ok = writeNetpbmHeader(this->file, this->options.format, this->width, this->height, this->samplesPerPixel);
+      break;
+    case ImageFormat::QOI:
+      this->qoi.writeHeader(this->width, this->height, this->encoded);
+      break;
+    default:
+      break;
+    }
+    return ok;
+  }
+
+  bool writeRows(const uint8_t *rgba, int numRows) override
+  {
+    if (numRows > this->rowsLeft) return false;
+    this->rowsLeft -= numRows;
+    Image image = {this->width, numRows, 4, rgba, false};
+    if (this->options.alpha != AlphaMode::Keep) {
+      const size_t outRowBytes = static_cast<size_t>(this->width) * this->samplesPerPixel;
+      this->converted.resize(outRowBytes * numRows);
+      for (int y = 0; y < numRows; ++y) {
+        convertAlphaRow(image.row(y), this->converted.data() + y * outRowBytes, this->width, this->options.alpha);
+      }
+      image = {this->width, numRows, this->samplesPerPixel, this->converted.data(), false};
+    }
+
+    bool ok = true;
+    switch (this->options.format) {
+    case ImageFormat::PNG:
+#ifdef HAS_ZLIB
+      ok = this->png.writeRows(image.data, numRows);
+#endif
+      break;
+    case ImageFormat::PPM:
+      ok = writeRGBRows(this->file, image);
+      break;
+    case ImageFormat::QOI:
+      for (int y = 0; y < numRows; ++y) this->qoi.encodeRow(image.row(y), this->width, this->encoded);
+      ok = fwrite(this->encoded.data(), 1, this->encoded.size(), this->file) == this->encoded.size();
+      this->encoded.clear();
+      break;
+    default:
+      ok = ::writeRows(this->file, image);
+      break;
+    }
+    if (!ok) {
+      std::cerr << "Error writing " << imageFormatName(this->options.format) << " image " << this->filename << std::endl;
+    }
+    return ok;
+  }
+
+  bool finish() override
+  {
+    if (this->rowsLeft > 0) {
+      std::cerr << "Missing " << this->rowsLeft << " rows of " << this->filename << std::endl;
+    }
+    if (this->options.format == ImageFormat::PNG) {
+#ifdef HAS_ZLIB
+      return this->png.finish() && this->rowsLeft == 0;
+#endif
+    }
+    if (!this->file) return false;
+    bool ok = true;
+    if (this->options.format == ImageFormat::QOI) {
+      this->qoi.finish(this->encoded);
+      ok = fwrite(this->encoded.data(), 1, this->encoded.size(), this->file) == this->encoded.size();
+    }
+    ok = (fclose(this->file) == 0) && ok;
+    this->file = nullptr;
+    if (!ok) {
+      std::cerr << "Error writing " << imageFormatName(this->options.format) << " image " << this->filename << std::endl;
+    }
+    return ok && this->rowsLeft == 0;
+  }
+};
+
+} // namespace
+
+bool parseImageFormat(const std::string& name, ImageFormat& format)
+{
+  std::string lower = name;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  for (const auto& entry : formatNames) {
+    if (lower == entry.name) {
+      format = entry.format;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool parseAlphaMode(const std::string& name, AlphaMode& mode)
+{
+  for (const auto& entry : alphaModeNames) {
+    if (name == entry.name) {
+      mode = entry.mode;
+      return true;
+    }
+  }
+  return false;
+}
+
+ImageFormat imageFormatFromFilename(const std::string& filename)
+{
+  ImageFormat format = ImageFormat::PNG;
+  const auto dot = filename.rfind('.');
+  if (dot != std::string::npos) parseImageFormat(filename.substr(dot + 1), format);
+  return format;
+}
+
+const char *imageFormatName(ImageFormat format)
+{
+  for (const auto& entry : formatNames) {
+    if (entry.format == format) return entry.name;
+  }
+  return "unknown";
+}
+
+bool writeImage(const char *filename, int width, int height, const uint8_t *rgba, const OutputOptions& options)
+{
+  Image image = {width, height, 4, rgba, options.bottomUp};
+  std::vector<uint8_t> converted;
+  // PPM drops alpha anyway, no need for a copy
+  const bool dropOnWrite = options.format == ImageFormat::PPM && options.alpha == AlphaMode::Drop;
+  if (options.alpha != AlphaMode::Keep && !dropOnWrite) {
+    converted = convertAlpha(image, options.alpha);
+    image = {width, height, options.alpha == AlphaMode::Drop ? 3 : 4, converted.data(), false};
+  }
+
+  if (options.format == ImageFormat::PNG) {
+    return writePNG(filename, image, options);
+  }
+
+  FILE *f = fopen(filename, "wb");
+  if (!f) {
+    std::cerr << "Unable to open " << filename << " for writing" << std::endl;
+    return false;
+  }
+  bool ok = false;
+  switch (options.format) {
+  case ImageFormat::RAW:
+    ok = writeRows(f, image);
+    break;
+  case ImageFormat::PPM:
+    ok = writeNetpbmHeader(f, options.format, width, height, image.samplesPerPixel) && writeRGBRows(f, image);
+    break;
+  case ImageFormat::PAM:
+    ok = writeNetpbmHeader(f, options.format, width, height, image.samplesPerPixel) && writeRows(f, image);
+    break;
+  case ImageFormat::QOI: {
+    const auto qoi = encodeQOI(image);
+    ok = fwrite(qoi.data(), 1, qoi.size(), f) == qoi.size();
+    break;
+  }
+  default:
+    break;
+  }
+  ok = (fclose(f) == 0) && ok;
+  if (!ok) {
+    std::cerr << "Error writing " << imageFormatName(options.format) << " image " << filename << std::endl;
+  }
+  return ok;
+}
+
+std::unique_ptr<ImageRowWriter> createImageRowWriter(const char *filename, int width, int height,
+                                                     const OutputOptions& options)
+{
+  auto writer = std::make_unique<FileRowWriter>(filename, width, height, options);
+  if (!writer->open()) return nullptr;
+  return writer;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+enum class ImageFormat {
+  PNG,
+  RAW, // Headerless RGBA
+  PPM, // Binary RGB (P6), drops alpha
+  PAM, // RGB_ALPHA (P7)
+  QOI,
+};
+
+enum class AlphaMode {
+  Keep,          // Write RGBA as read back
+  Drop,          // Write RGB, 25% less data to encode
+  Premultiply,   // Multiply color by alpha
+  Unpremultiply, // Divide color by alpha, e.g. for content rendered with premultiplied blending
+};
+
+struct OutputOptions {
+  ImageFormat format = ImageFormat::PNG;
+  // Number of threads for the stripe-parallel PNG encoder; 0 means use stb_image_write
+  unsigned int pngThreads = 0;
+  // Readback rows are in OpenGL's bottom-up order, unless the GPU flipped them for us
+  bool bottomUp = true;
+  AlphaMode alpha = AlphaMode::Keep;
+};
+
+// Parses a format name ("png", "raw", "ppm", "pam", "qoi"). Returns false if unknown.
+bool parseImageFormat(const std::string& name, ImageFormat& format);
+// Guesses the format from the file extension, defaulting to PNG
+ImageFormat imageFormatFromFilename(const std::string& filename);
+const char *imageFormatName(ImageFormat format);
+// Parses an alpha mode name ("keep", "drop", "premultiply", "unpremultiply"). Returns false if unknown.
+bool parseAlphaMode(const std::string& name, AlphaMode& mode);
+
+// Writes an 8-bit RGBA image in the format and alpha mode given by options
+bool writeImage(const char *filename, int width, int height, const uint8_t *rgba, const OutputOptions& options);
+
+// Writes an image a band of rows at a time, so it never has to be in memory as a whole
+class ImageRowWriter
+{
+public:
+  virtual ~ImageRowWriter() = default;
+  // Appends numRows rows of 8-bit RGBA, top row first
+  virtual bool writeRows(const uint8_t *rgba, int numRows) = 0;
+  // Fails if fewer rows than the image height were written
+  virtual bool finish() = 0;
+};
+
+// Opens filename for writing row by row. options.bottomUp is ignored. PNG needs zlib.
+std::unique_ptr<ImageRowWriter> createImageRowWriter(const char *filename, int width, int height,
+                                                     const OutputOptions& options);
@@ -1,14 +1,18 @@
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
 #include <numeric>
 #include <iostream>
 #include <locale>
+#include <map>
 #include <sstream>
 #include <iterator>
+#include <mutex>
 
-#ifdef USE_GLAD
-#define GLAD_GL_IMPLEMENTATION
-#define GLAD_EGL_IMPLEMENTATION
-#endif
 #include "system-gl.h"
 
 #ifdef ENABLE_GLFW
@@ -18,15 +22,29 @@
 
 #include "CommandLine.h"
 #include "OffscreenContextFactory.h"
+#include "OffscreenContextPool.h"
 #include "FBO.h"
+#include "AsyncReadback.h"
+#include "GpuProfiler.h"
+#include "DirtyRegionTracker.h"
 #include "state.h"
 #include "render_immediate.h"
 #include "render_modern_ogl2.h"
 #include "render_modern_ogl3.h"
 #include "egl_utils.h"
-
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "ext/stb/stb_image_write.h"
+#include "image_writers.h"
+#include "FrameStream.h"
+#include "ImageSequenceSink.h"
+#include "pixel_convert.h"
+#include "tiled_render.h"
+#include "atlas_batch.h"
+#include "phase_timings.h"
+#include "shader_cache.h"
+#include "LatencyHistogram.h"
+#include "scope_guard.hpp"
+#ifdef HAS_RENDER_SERVER
+#include "RenderServer.h"
+#endif
 
 #ifdef __APPLE__
 #include <mach-o/dyld.h>
@@ -47,19 +65,206 @@ void * MyNSGLGetProcAddress(const char *name)
 }
 #endif // __APPLE__
 
-bool saveFramebuffer(const OpenGLContext& ctx, const char *filename)
+bool writeFramebuffer(const PixelRect& rect, const PixelBuffer& buffer, const char *filename,
+                      const OutputOptions& options)
+{
+  PhaseTimer timer("Encode");
+  return writeImage(filename, rect.width, rect.height, buffer.data(), options);
+}
+
+bool saveFramebuffer(const OpenGLContext& ctx, const PixelRect& rect, PixelBuffer& buffer, const char *filename,
+                     const OutputOptions& options)
+{
+  PhaseTimer timer("Readback");
+  if (!ctx.getFramebuffer(rect, buffer)) return false;
+  timer.stop();
+  return writeFramebuffer(rect, buffer, filename, options);
+}
+
+bool saveFramebufferAsync(AsyncReadback& readback, const PixelRect& rect, PixelBuffer& buffer, const char *filename,
+                          const OutputOptions& options)
 {
-  const auto buffer = ctx.getFramebuffer();
-  stbi_flip_vertically_on_write(true);
-  int samplesPerPixel = 4; // R, G, B and A
-  if (stbi_write_png(filename, ctx.width(), ctx.height(), samplesPerPixel, buffer.data(), 0) != 1) {
-    std::cerr << "stbi_write_png(\"" << filename << "\") failed" << std::endl;
+  PhaseTimer timer("Readback");
+  if (!readback.requestReadback()) {
+    std::cerr << "Unable to queue framebuffer readback" << std::endl;
     return false;
   }
+  if (!readback.collect(buffer)) return false;
+  timer.stop();
+  return writeFramebuffer(rect, buffer, filename, options);
+}
 
+// Renders a width x height image in tiles of up to the framebuffer's size, and streams it to filename
+// one band of tiles at a time. renderTile renders the given part of the image into the framebuffer's
+// bottom left corner.
+bool saveFramebufferTiled(const OpenGLContext& ctx, int width, int height,
+                          const std::function<void(const PixelRect&)>& renderTile, const char *filename,
+                          const OutputOptions& options)
+{
+  auto writer = createImageRowWriter(filename, width, height, options);
+  if (!writer) return false;
+  const int tileWidth = std::min(ctx.width(), width);
+  const int tileHeight = std::min(ctx.height(), height);
+  PixelBuffer band;
+  band.resize(4 * static_cast<size_t>(width) * tileHeight);
+  for (int top = 0; top < height; top += tileHeight) {
+    const int bandHeight = std::min(tileHeight, height - top);
+    for (int x = 0; x < width; x += tileWidth) {
+      // Window coordinates count rows from the bottom
+      const PixelRect tile = {x, height - top - bandHeight, std::min(tileWidth, width - x), bandHeight};
+      renderTile(tile);
+      if (!ctx.readPixels({0, 0, tile.width, tile.height}, band.data() + 4 * static_cast<size_t>(x), width)) {
+        return false;
+      }
+    }
+    flipRows(band.data(), 4 * static_cast<size_t>(width), bandHeight);
+    if (!writer->writeRows(band.data(), bandHeight)) return false;
+  }
+  return writer->finish();
+}
+
+// Renders numFrames frames and hands each one to sink, in order.
+// readFrame does synchronous readback, and fills in dirtyRegions if given.
+// With a readback ring, frame N is copied out while frame N+1 renders.
+bool renderFrames(unsigned int numFrames, const std::function<void()>& renderFrame,
+                  const std::function<bool(PixelBuffer&)>& readFrame, const std::vector<PixelRect> *dirtyRegions,
+                  AsyncReadback *readback, FrameSink& sink)
+{
+  const auto collectFrame = [&]() {
+    auto& buffer = sink.acquireBuffer();
+    if (!readback->collect(buffer)) {
+      sink.releaseBuffer(buffer);
+      return false;
+    }
+    return sink.submitFrame(buffer);
+  };
+  for (unsigned int i = 0; i < numFrames; ++i) {
+    renderFrame();
+    if (!readback) {
+      auto& buffer = sink.acquireBuffer();
+      if (!readFrame(buffer)) {
+        sink.releaseBuffer(buffer);
+        return false;
+      }
+      if (!(dirtyRegions ? sink.submitFrame(buffer, *dirtyRegions) : sink.submitFrame(buffer))) return false;
+      continue;
+    }
+    if (readback->isFull() && !collectFrame()) return false;
+    if (!readback->requestReadback()) return false;
+  }
+  while (readback && readback->numPending() > 0) {
+    if (!collectFrame()) return false;
+  }
+  return true;
+}
+
+// Renders warmup frames, then times numFrames more, each rendered, finished, read back and encoded in
+// turn, and prints frames/s and percentiles of each stage. Without readFrame only rendering is timed.
+bool benchmarkFrames(unsigned int numFrames, unsigned int warmup, const std::function<void()>& renderFrame,
+                     const std::function<bool(PixelBuffer&)>& readFrame,
+                     const std::function<bool(const PixelBuffer&)>& encodeFrame)
+{
+  using Clock = std::chrono::steady_clock;
+  enum Stage { Render, Finish, Readback, Encode, Frame, NumStages };
+  const char *stageNames[NumStages] = {"Render", "Finish", "Readback", "Encode", "Frame"};
+  LatencyHistogram histograms[NumStages];
+  const auto record = [&](Stage stage, Clock::time_point from, Clock::time_point to) {
+    histograms[stage].record(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+  };
+
+  PixelBuffer buffer;
+  Clock::time_point start;
+  for (unsigned int i = 0; i < warmup + numFrames; ++i) {
+    if (i == warmup) start = Clock::now();
+    const auto frameStart = Clock::now();
+    renderFrame();
+    const auto rendered = Clock::now();
+    glFinish();
+    const auto finished = Clock::now();
+    auto readDone = finished;
+    auto encoded = finished;
+    if (readFrame) {
+      if (!readFrame(buffer)) return false;
+      readDone = Clock::now();
+      if (!encodeFrame(buffer)) return false;
+      encoded = Clock::now();
+    }
+    if (i < warmup) continue;
+    record(Render, frameStart, rendered);
+    record(Finish, rendered, finished);
+    if (readFrame) {
+      record(Readback, finished, readDone);
+      record(Encode, readDone, encoded);
+    }
+    record(Frame, frameStart, encoded);
+  }
+  const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  const auto oldFlags = std::cout.flags();
+  const auto oldPrecision = std::cout.precision();
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << "Benchmark: " << numFrames << " frames in " << seconds << " s, " << std::setprecision(1)
+            << numFrames / seconds << " frames/s\n" << std::setprecision(3);
+  std::cout << "  " << std::left << std::setw(10) << "Stage" << std::right;
+  for (const char *column : {"Mean ms", "p50 ms", "p95 ms", "p99 ms", "Max ms"}) std::cout << std::setw(10) << column;
+  std::cout << "\n";
+  for (int stage = 0; stage < NumStages; stage++) {
+    const auto& histogram = histograms[stage];
+    if (histogram.count() == 0) continue;
+    std::cout << "  " << std::left << std::setw(10) << stageNames[stage] << std::right
+              << std::setw(10) << histogram.mean() / 1e6;
+    for (double percent : {50.0, 95.0, 99.0}) std::cout << std::setw(10) << histogram.percentile(percent) / 1e6;
+    std::cout << std::setw(10) << histogram.max() / 1e6 << "\n";
+  }
+  std::cout << std::flush;
+  std::cout.flags(oldFlags);
+  std::cout.precision(oldPrecision);
   return true;
 }
 
+// Renders numFrames independent frames on one thread per context in pool, and hands them to sink in
+// order. setupWorker runs on each thread with its context current, and returns the function
+// rendering and reading back one frame there, or an empty function if it failed.
+bool renderFramesParallel(OffscreenContextPool& pool, unsigned int numFrames,
+                          const std::function<std::function<bool(PixelBuffer&)>(OpenGLContext&)>& setupWorker,
+                          FrameSink& sink)
+{
+  std::atomic<unsigned int> nextFrame{0};
+  std::atomic<bool> failed{false};
+  std::mutex sinkMutex;
+  // Frames which finished before an earlier one, by frame number, and the next frame to submit
+  std::map<unsigned int, PixelBuffer *> finished;
+  unsigned int nextSubmit = 0;
+  pool.run([&](OpenGLContext& ctx) {
+    // Destroyed before the context is released
+    const auto readFrame = setupWorker(ctx);
+    if (!readFrame) {
+      failed = true;
+      return;
+    }
+    while (!failed) {
+      // Taken before claiming a frame, so the oldest unsubmitted frame always has a buffer, and
+      // later frames waiting for it can't use them all up
+      auto& buffer = sink.acquireBuffer();
+      const unsigned int frame = nextFrame++;
+      if (frame >= numFrames || failed || !readFrame(buffer)) {
+        if (frame < numFrames) failed = true;
+        sink.releaseBuffer(buffer);
+        return;
+      }
+      std::lock_guard<std::mutex> lock(sinkMutex);
+      finished[frame] = &buffer;
+      while (!failed && !finished.empty() && finished.begin()->first == nextSubmit) {
+        auto& next = *finished.begin()->second;
+        finished.erase(finished.begin());
+        nextSubmit++;
+        if (!sink.submitFrame(next)) failed = true;
+      }
+    }
+  });
+  for (const auto& [frame, buffer] : finished) sink.releaseBuffer(*buffer);
+  return !failed;
+}
 
 int main(int argc, char *argv[])
 {
@@ -76,6 +281,30 @@ int main(int argc, char *argv[])
   std::string argGPU = "";
   bool argDumpEGL = false;
   std::string argOut = "";
+  std::string argFormat = "";
+  std::string argAlpha = "keep";
+  bool argAsyncReadback = false;
+  bool argGpuYuv = false;
+  std::string argRoi;
+  uint32_t argDirtyTiles = 0;
+  bool argSkipDuplicates = false;
+  bool argStaticScene = false;
+  uint32_t argFrames = 0;
+  bool argBench = false;
+  uint32_t argWarmup = 10;
+  uint32_t argFps = 30;
+  uint32_t argWriterThreads = 2;
+  uint32_t argRenderThreads = 1;
+  uint32_t argTileSize = 0;
+  uint32_t argSamples = 0;
+  uint32_t argBatch = 0;
+  std::string argServe;
+  std::string argRequest;
+  bool argStopServer = false;
+  OutputOptions outputOptions;
+  std::string argShaderCache;
+  std::string argTimings;
+  bool argGpuTimings = false;
   bool argVerbose = false;
   bool argPrintHelp = false;
 
@@ -100,11 +329,39 @@ int main(int argc, char *argv[])
   args.addArgument({"--profile"}, &argProfile, "OpenGL profile [core | compatibility]");
   args.addArgument({"--invisible"}, &argInvisible, "Make window invisible");
   args.addArgument({"--mode"}, &argRenderMode, "Rendering mode [auto | immediate | modern]");
- #ifdef HAS_GBM
-  args.addArgument({"--gpu"}, &argGPU, "[EGL] Which GPU to use (e.g. /dev/dri/renderD128)");
+ #ifdef HAS_EGL
+  args.addArgument({"--gpu"}, &argGPU, "[EGL] Which GPU to use: EGL device index (e.g. 1) or DRM node (e.g. /dev/dri/renderD128)");
  #endif
   args.addArgument({"--dump-egl"}, &argDumpEGL, "Dump verbose EGL info.");
   args.addArgument({"-o", "--out"}, &argOut, "Write framebuffer to file.");
+  args.addArgument({"--format"}, &argFormat, "Output format [png | raw | ppm | pam | qoi] (default: from file extension). When streaming frames: [y4m | raw] (default: y4m).");
+  args.addArgument({"--alpha"}, &argAlpha, "Alpha channel of image output [keep | drop | premultiply | unpremultiply]. drop writes 3-channel images.");
+  args.addArgument({"--frames"}, &argFrames, "Render this many frames, and stream them to the output file, FIFO or stdout (-o -), or write an image sequence (e.g. -o frame_%04d.png).");
+  args.addArgument({"--bench"}, &argBench, "Render --frames frames after --warmup ones, and print frames/s and percentiles of render, finish, readback and encode times. With -o each frame is read back and encoded (overwriting it).");
+  args.addArgument({"--warmup"}, &argWarmup, "Untimed frames to render before --bench starts timing.");
+  args.addArgument({"--fps"}, &argFps, "Frame rate to put in the Y4M header.");
+  args.addArgument({"--writer-threads"}, &argWriterThreads, "Number of background threads writing image sequences.");
+  args.addArgument({"--render-threads"}, &argRenderThreads, "Render image sequences on this many threads, each with its own context sharing programs and buffers [EGL].");
+#ifdef HAS_ZLIB
+  args.addArgument({"--png-threads"}, &outputOptions.pngThreads, "Encode PNG stripes on this many threads (0: single-threaded stb_image_write).");
+#endif
+  args.addArgument({"--samples"}, &argSamples, "Anti-alias by rendering into a multisampled FBO with this many samples per pixel, resolved before readback.");
+  args.addArgument({"--tile-size"}, &argTileSize, "Render the image in tiles of this size and write it band by band, for images larger than the GPU supports (single images only).");
+  args.addArgument({"--batch"}, &argBatch, "Render this many images into the cells of one large framebuffer, read them back together and write them as an image sequence (e.g. -o thumb_%04d.png).");
+#ifdef HAS_RENDER_SERVER
+  args.addArgument({"--serve"}, &argServe, "Keep the context, FBO and shaders alive and render requests sent to this Unix socket (see --request).");
+  args.addArgument({"--request"}, &argRequest, "Ask the server on this socket to render an image with --width, --height, --mode, --format, --alpha and -o.");
+  args.addArgument({"--stop-server"}, &argStopServer, "With --request, shut the server down instead.");
+#endif
+  args.addArgument({"--gpu-yuv"}, &argGpuYuv, "Convert Y4M frames to YUV 4:2:0 on the GPU (modern mode, width divisible by 4, even height).");
+  args.addArgument({"--roi"}, &argRoi, "Only read back and write this region: x,y,width,height (from the top left).");
+  args.addArgument({"--dirty-tiles"}, &argDirtyTiles, "When rendering frames, only read back tiles of this size which changed since the last frame (modern mode, synchronous readback).");
+  args.addArgument({"--skip-duplicates"}, &argSkipDuplicates, "When rendering frames, hash each frame and don't encode it again if it didn't change: image sequences get hard links, Y4M streams repeat the last converted frame.");
+  args.addArgument({"--static-scene"}, &argStaticScene, "Draw every frame with the same clear color instead of a random one, so all frames are identical.");
+  args.addArgument({"--async-readback"}, &argAsyncReadback, "Read back framebuffer through pixel pack buffers and fences.");
+  args.addArgument({"--shader-cache"}, &argShaderCache, "Keep linked program binaries in this directory and load them instead of compiling shaders on later runs.");
+  args.addArgument({"--timings"}, &argTimings, "Print how long each phase of startup, rendering and writing took [table | json].");
+  args.addArgument({"--gpu-timings"}, &argGpuTimings, "Measure the GPU time and primitive counts of clears, draws and readbacks with timer queries, and print them at exit.");
   args.addArgument({"-v", "--verbose"}, &argVerbose, "Verbose output.");
   args.addArgument({"-h", "--help"}, &argPrintHelp, "Print this help.");
 
@@ -122,6 +379,121 @@ int main(int argc, char *argv[])
     return 0;
   }
 
+  if (!argTimings.empty()) {
+    if (argTimings != "table" && argTimings != "json") {
+      std::cerr << "Unknown --timings format \"" << argTimings << "\"" << std::endl;
+      return 1;
+    }
+    enablePhaseTimings();
+  }
+  // Printed on every way out of main()
+  auto timingsGuard = sg::make_scope_guard([&argTimings]() {
+    if (phaseTimingsEnabled()) printPhaseTimings(std::cout, argTimings == "json");
+  });
+
+#ifdef HAS_RENDER_SERVER
+  if (!argRequest.empty()) {
+    std::string line = "shutdown";
+    if (!argStopServer) {
+      if (argOut.empty()) {
+        std::cerr << "--request requires an output (-o)" << std::endl;
+        return 1;
+      }
+      RenderRequest request;
+      request.width = argWidth;
+      request.height = argHeight;
+      request.mode = argRenderMode == "auto" ? "" : argRenderMode;
+      request.format = argFormat;
+      request.alpha = argAlpha;
+      // The server may run in another directory
+      request.out = std::filesystem::absolute(argOut).string();
+      if (request.out.find_first_of(" \t") != std::string::npos) {
+        std::cerr << "--request doesn't support whitespace in output paths" << std::endl;
+        return 1;
+      }
+      line = formatRenderRequest(request);
+    }
+    std::string reply;
+    if (!sendRenderRequest(argRequest, line, reply)) return 1;
+    std::cout << reply << std::endl;
+    return reply.rfind("ok", 0) == 0 ? 0 : 1;
+  }
+#endif
+
+  StreamFormat streamFormat = StreamFormat::Y4M;
+  const bool writeSequence = argFrames > 0 && isImageSequencePattern(argOut);
+  if (argFrames > 0 && !writeSequence && !argBench) {
+    if (argOut.empty()) {
+      std::cerr << "--frames requires an output (-o)" << std::endl;
+      return 1;
+    }
+    const auto dot = argOut.rfind('.');
+    const auto formatName = !argFormat.empty() ? argFormat :
+      dot != std::string::npos ? argOut.substr(dot + 1) : "y4m";
+    if (!parseStreamFormat(formatName, streamFormat)) {
+      std::cerr << "Unknown stream format \"" << formatName << "\"" << std::endl;
+      return 1;
+    }
+  } else if (!argFormat.empty()) {
+    if (!parseImageFormat(argFormat, outputOptions.format)) {
+      std::cerr << "Unknown output format \"" << argFormat << "\"" << std::endl;
+      return 1;
+    }
+  } else if (!argOut.empty()) {
+    outputOptions.format = imageFormatFromFilename(argOut);
+  }
+
+  if (!parseAlphaMode(argAlpha, outputOptions.alpha)) {
+    std::cerr << "Unknown alpha mode \"" << argAlpha << "\"" << std::endl;
+    return 1;
+  }
+
+  PixelRect roi = {0, 0, static_cast<int>(argWidth), static_cast<int>(argHeight)};
+  if (!argRoi.empty()) {
+    if (sscanf(argRoi.c_str(), "%d,%d,%d,%d", &roi.x, &roi.y, &roi.width, &roi.height) != 4 ||
+        roi.x < 0 || roi.y < 0 || roi.width <= 0 || roi.height <= 0 ||
+        roi.x + roi.width > static_cast<int>(argWidth) || roi.y + roi.height > static_cast<int>(argHeight)) {
+      std::cerr << "Invalid region \"" << argRoi << "\" for " << argWidth << "x" << argHeight << " framebuffer" << std::endl;
+      return 1;
+    }
+  }
+
+  if (argTileSize > 0) {
+    if (argFrames > 0 || argOut.empty() || !argRoi.empty() || argAsyncReadback) {
+      std::cerr << "--tile-size only supports writing single images (-o), without --roi or --async-readback" << std::endl;
+      return 1;
+    }
+  }
+
+  if (!argServe.empty()) {
+    if (argFrames > 0 || argTileSize > 0 || argBatch > 0 || !argRoi.empty() || argAsyncReadback) {
+      std::cerr << "--serve doesn't support --frames, --tile-size, --batch, --roi or --async-readback" << std::endl;
+      return 1;
+    }
+  }
+
+  if (argBatch > 0) {
+    if (argFrames > 0 || argTileSize > 0 || !isImageSequencePattern(argOut) || !argRoi.empty() || argAsyncReadback) {
+      std::cerr << "--batch needs an image sequence output (e.g. -o thumb_%04d.png), and doesn't support "
+                << "--frames, --tile-size, --roi or --async-readback" << std::endl;
+      return 1;
+    }
+  }
+
+  if (argBench) {
+    if (argFrames == 0 || writeSequence || argOut == "-" || argTileSize > 0 || argBatch > 0 || !argServe.empty() ||
+        argAsyncReadback || argDirtyTiles > 0 || argGpuYuv) {
+      std::cerr << "--bench needs --frames and at most a single image output (-o), and doesn't support "
+                << "--tile-size, --batch, --serve, --async-readback, --dirty-tiles or --gpu-yuv" << std::endl;
+      return 1;
+    }
+  }
+
+  // Keep stdout clean for the frame stream
+  if (argOut == "-") {
+    std::cout.rdbuf(std::cerr.rdbuf());
+  }
+
   std::string requestVersion;
   if (!argGLVersion.empty() && !argGLESVersion.empty()) {
     std::cerr << "Only one of --opengl or --gles can be specified" << std::endl;
@@ -159,14 +531,29 @@ int main(int argc, char *argv[])
   std::cout << "  Context provider: " << argContextProvider << "\n";
   std::cout << "  " << (requestGLES ? "GLES" : "OpenGL") << ": " << requestMajor << "." << requestMinor << "\n";
   std::cout << "  Size: " << argWidth << " x " << argHeight << "\n";
+  // When tiling, only a single tile has to fit into the framebuffer
+  uint32_t framebufferWidth = argTileSize > 0 ? std::min(argTileSize, argWidth) : argWidth;
+  uint32_t framebufferHeight = argTileSize > 0 ? std::min(argTileSize, argHeight) : argHeight;
+  if (argTileSize > 0) {
+    std::cout << "  Tile size: " << framebufferWidth << " x " << framebufferHeight << "\n";
+  }
+  // Batches are packed into an atlas no larger than most GPUs support
+  const int maxAtlasSize = 2048;
+  AtlasLayout atlas;
+  if (argBatch > 0) {
+    atlas = atlasLayout(argWidth, argHeight, argBatch, maxAtlasSize);
+    framebufferWidth = atlas.width();
+    framebufferHeight = atlas.height();
+    std::cout << "  Atlas: " << atlas.columns << " x " << atlas.rows << " cells\n";
+  }
 
   std::shared_ptr<OpenGLContext> ctx;
 
   std::transform(argContextProvider.begin(), argContextProvider.end(), argContextProvider.begin(), ::tolower);
 
   OffscreenContextFactory::ContextAttributes attrib = {
-    .width = argWidth,
-    .height = argHeight,
+    .width = framebufferWidth,
+    .height = framebufferHeight,
     .majorGLVersion = requestMajor,
     .minorGLVersion = requestMinor,
     .gles = requestGLES,
@@ -174,14 +561,17 @@ int main(int argc, char *argv[])
     .gpu = argGPU,
     .invisible = argInvisible,
   };
+  PhaseTimer contextTimer("Context creation");
   ctx = OffscreenContextFactory::create(argContextProvider, attrib);
   if (!ctx) {
     std::cerr << "Error: Unable to create GL context" << std::endl;
     return 1;
   }
   ctx->makeCurrent();
+  contextTimer.stop();
 
 #ifdef USE_GLAD
+  PhaseTimer gladTimer("GLAD load");
   int version;
 #ifdef ENABLE_GLFW
   if (argContextProvider == "glfw") {
@@ -197,6 +587,7 @@ int main(int argc, char *argv[])
   }
   std::cout << "GLAD: Loaded " << (requestGLES ? "GLES" : "OpenGL") << " "
             << GLAD_VERSION_MAJOR(version) <<"." << GLAD_VERSION_MINOR(version) << std::endl;
+  gladTimer.stop();
 #endif
 
 
@@ -242,8 +633,8 @@ int main(int argc, char *argv[])
 #ifdef __APPLE__
 // FIXME: This can probably be removed: It was just some code to prove that MyNSGLGetProcAddress() returned the same function pointer as the OpenGL library itself provides.
   GL_CHECK();
-  printf("NSLookupAndBindSymbol glFramebufferTexture: %p\n", MyNSGLGetProcAddress("glFramebufferTexture"));
-  printf("OpenGL glFramebufferTexture: %p\n", glFramebufferTexture);
+  std::cout << "NSLookupAndBindSymbol glFramebufferTexture: " << MyNSGLGetProcAddress("glFramebufferTexture") << std::endl;
+  std::cout << "OpenGL glFramebufferTexture: " << reinterpret_cast<void *>(glFramebufferTexture) << std::endl;
   GL_CHECK();
 #endif
 
@@ -282,17 +673,101 @@ int main(int argc, char *argv[])
     std::cout << std::endl;
   }
 
+  // Results are collected while frames render, and the rest once main() is done with the context
+  std::unique_ptr<GpuProfiler> gpuProfiler;
+  if (argGpuTimings) {
+    gpuProfiler = createGpuProfiler(*ctx);
+    activeGpuProfiler = gpuProfiler.get();
+  }
+  auto gpuTimingsGuard = sg::make_scope_guard([&gpuProfiler]() {
+    if (!gpuProfiler) return;
+    activeGpuProfiler = nullptr;
+    gpuProfiler->finish();
+    gpuProfiler->print(std::cout);
+  });
+
   std::unique_ptr<FBO> fbo;
+  std::unique_ptr<FBO> flipFbo;
+  std::unique_ptr<FBO> resolveFbo;
   if (ctx->isOffscreen()) {
+    GLint maxRenderbufferSize = 0;
+    glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &maxRenderbufferSize);
+    if (maxRenderbufferSize > 0 && std::max(ctx->width(), ctx->height()) > maxRenderbufferSize) {
+      std::cerr << "Framebuffer size exceeds GL_MAX_RENDERBUFFER_SIZE (" << maxRenderbufferSize << ")"
+                << (argTileSize > 0 ? ", use a smaller --tile-size" : ", use --tile-size") << std::endl;
+      return 1;
+    }
     std::cout << "Creating FBO..." << std::endl;
-    fbo = createFBO(*ctx);
+    PhaseTimer fboTimer("FBO creation");
+    fbo = createFBO(*ctx, argSamples);
     std::cout << "FBO: " << (fbo ? "OK" : "Failed") << std::endl;
     if (!fbo) return 1;
+
+    if (fbo->samples() > 0) {
+      // Multisampled buffers can't be read back, resolve them into a single-sample FBO first.
+      // Resolving can't flip at the same time, so rows stay bottom-up.
+      std::cout << "Samples: " << fbo->samples() << std::endl;
+      resolveFbo = createBlitFBO(*ctx);
+      if (!resolveFbo) {
+        std::cerr << "Unable to create FBO to resolve samples into" << std::endl;
+        return 1;
+      }
+      resolveFbo->unbind();
+    } else if (argTileSize == 0 && argBatch == 0) {
+      // Flip the image on the GPU while copying it out of the FBO, so readback is top-down.
+      // Tiles are flipped band by band instead, and batches cell by cell.
+      flipFbo = createBlitFBO(*ctx);
+    }
+    if (flipFbo) {
+      flipFbo->unbind();
+      outputOptions.bottomUp = false;
+    }
+    fboTimer.stop();
+  } else if (argSamples > 0) {
+    std::cerr << "--samples needs an offscreen context, ignoring" << std::endl;
+  }
+
+  ctx->queryReadFormat();
+  if (argVerbose) {
+    std::cout << "Preferred read format: " << (ctx->readsBGRA() ? "BGRA" : "RGBA") << std::endl;
+    std::cout << "Pixel conversion kernels: " << pixelISAName(activePixelISA()) << std::endl;
   }
 
   GL_CHECK(glViewport(0, 0, ctx->width(), ctx->height()));
 
+  // --roi counts rows from the top, like the output
+  const PixelRect readRect = {
+    roi.x, outputOptions.bottomUp ? ctx->height() - roi.y - roi.height : roi.y, roi.width, roi.height
+  };
+
   std::vector<MyState> states;
+  ProgramRegistry programs;
+
+  std::string glslVersion = "120";
+  if (!requestGLES) {
+    if (glMajor >= 4 || glMajor == 3 && glMinor >= 3) {
+      glslVersion = "330";
+    } else if (glMajor == 3) {
+      glslVersion = "140";
+    }
+  } else {
+    if (glMajor >= 3) {
+      glslVersion = "300 es";
+    } else if (glMajor == 2) {
+      glslVersion = "100 es";
+    }
+  }
+  // Kept apart, so the server can switch modes
+  std::function<void()> setupModern;
+  std::function<void()> renderModern;
+  const bool modernOGL3 = requestGLES || glMajor >= 3;
+  if (modernOGL3) {
+    setupModern = [&states, &glslVersion, &programs]() { setupModernOGL3(states, glslVersion, programs); };
+    renderModern = [&states]() { renderModernOGL3(states); };
+  } else {
+    setupModern = [&states, &glslVersion, &programs]() { setupModernOGL2(states, glslVersion, programs); };
+    renderModern = [&states]() { renderModernOGL2(states); };
+  }
 
   std::function<void()> setup;
   std::function<void()> render;
@@ -302,30 +777,340 @@ int main(int argc, char *argv[])
     };
     render = renderImmediate;
   } else {
-    std::string glslVersion = "120";
-    if (!requestGLES) {
-      if (glMajor >= 4 || glMajor == 3 && glMinor >= 3) {
-        glslVersion = "330";
-      } else if (glMajor == 3) {
-        glslVersion = "140";
+    setup = setupModern;
+    render = renderModern;
+  }
+
+  setShaderCacheDirectory(argShaderCache);
+  {
+    PhaseTimer timer("Scene setup");
+    GL_CHECK(setup());
+  }
+
+  // Makes the multisampled FBO's contents readable, leaving it bound for drawing
+  const auto resolve = [&](int width, int height) {
+    if (resolveFbo) fbo->blitTo(*resolveFbo, width, height, /*flipY*/ false);
+  };
+
+#ifdef HAS_RENDER_SERVER
+  if (!argServe.empty()) {
+    if (!fbo) {
+      std::cerr << "--serve needs an offscreen context" << std::endl;
+      return 1;
+    }
+    RenderServer server;
+    if (!server.listen(argServe)) return 1;
+    std::cout << "Serving render requests on " << argServe << std::endl;
+
+    GLint maxRenderbufferSize = 0;
+    glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &maxRenderbufferSize);
+    const bool immediateSupported = !requestGLES && (glMajor == 2 || argProfile == "compatibility");
+    // FBOs only grow, smaller images are rendered into their bottom left corner
+    int fboWidth = ctx->width();
+    int fboHeight = ctx->height();
+    PixelBuffer buffer;
+    const bool served = server.serve([&](const RenderRequest& request, std::string& error) {
+      const uint32_t requestWidth = request.width > 0 ? request.width : argWidth;
+      const uint32_t requestHeight = request.height > 0 ? request.height : argHeight;
+      if (maxRenderbufferSize > 0 &&
+          std::max(requestWidth, requestHeight) > static_cast<uint32_t>(maxRenderbufferSize)) {
+        error = "size exceeds GL_MAX_RENDERBUFFER_SIZE (" + std::to_string(maxRenderbufferSize) + ")";
+        return false;
+      }
+      const int width = requestWidth;
+      const int height = requestHeight;
+      OutputOptions options = outputOptions;
+      options.format = imageFormatFromFilename(request.out);
+      if (!request.format.empty() && !parseImageFormat(request.format, options.format)) {
+        error = "unknown output format \"" + request.format + "\"";
+        return false;
+      }
+      if (!request.alpha.empty() && !parseAlphaMode(request.alpha, options.alpha)) {
+        error = "unknown alpha mode \"" + request.alpha + "\"";
+        return false;
+      }
+      const std::string mode = request.mode.empty() ? argRenderMode : request.mode;
+      if (mode == "immediate") {
+        if (!immediateSupported) {
+          error = "immediate mode needs a compatibility profile";
+          return false;
+        }
+        if (!states.empty()) {
+          GL_CHECK(glUseProgram(0));
+        }
+      } else if (mode == "modern") {
+        if (states.empty()) {
+          GL_CHECK(setupModern());
+        }
+      } else {
+        error = "unknown mode \"" + mode + "\"";
+        return false;
+      }
+
+      if (width > fboWidth || height > fboHeight) {
+        fboWidth = std::max(fboWidth, width);
+        fboHeight = std::max(fboHeight, height);
+        fbo->resize(fboWidth, fboHeight);
+        if (resolveFbo) resolveFbo->resize(fboWidth, fboHeight);
+        if (flipFbo) flipFbo->resize(fboWidth, fboHeight);
+        ctx->setFramebufferSize(fboWidth, fboHeight);
+      }
+      GL_CHECK(glViewport(0, 0, width, height));
+      if (mode == "immediate") {
+        GL_CHECK(renderImmediate());
+      } else {
+        GL_CHECK(renderModern());
+      }
+      resolve(width, height);
+      if (flipFbo) fbo->blitTo(*flipFbo, width, height, /*flipY*/ true);
+      glFinish();
+      if (!saveFramebuffer(*ctx, {0, 0, width, height}, buffer, request.out.c_str(), options)) {
+        error = "unable to write " + request.out;
+        return false;
+      }
+      return true;
+    });
+    std::cout << "Server stopped" << std::endl;
+    return served ? 0 : 1;
+  }
+#endif
+
+  // The scene picks a random clear color, reseeding with this makes it the same on every tile,
+  // and with --static-scene on every frame
+  const unsigned int sceneSeed = std::rand();
+  std::mutex sceneSeedMutex;
+
+  if (argTileSize > 0) {
+    const auto renderTile = [&](const PixelRect& tile) {
+      const auto transform = tileTransform(tile, argWidth, argHeight);
+      if (argRenderMode == "immediate") applyTileTransformImmediate(transform);
+      else applyTileTransform(states, transform);
+      GL_CHECK(glViewport(0, 0, tile.width, tile.height));
+      std::srand(sceneSeed);
+      GL_CHECK(render());
+      resolve(tile.width, tile.height);
+    };
+    PhaseTimer timer("Render tiles");
+    if (!saveFramebufferTiled(*ctx, argWidth, argHeight, renderTile, argOut.c_str(), outputOptions)) {
+      std::cerr << "Unable to write framebuffer to " << argOut << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  if (argBatch > 0) {
+    // Cells are flipped while being copied out of the atlas
+    OutputOptions cellOptions = outputOptions;
+    cellOptions.bottomUp = false;
+    ImageSequenceSink sink(argOut, argWidth, argHeight, cellOptions, argWriterThreads, argWriterThreads + 2);
+    sink.setSkipDuplicates(argSkipDuplicates);
+    const auto finishAtlas = [&]() { resolve(ctx->width(), ctx->height()); };
+    PhaseTimer timer("Render batch");
+    const bool rendered = renderAtlasBatch(*ctx, atlas, argBatch, render, finishAtlas, sink);
+    if (!sink.finish() || !rendered) {
+      std::cerr << "Unable to write images to " << argOut << std::endl;
+      return 1;
+    }
+    const unsigned int numAtlases = (argBatch + atlas.numCells() - 1) / atlas.numCells();
+    std::cout << "Rendered " << argBatch << " images in " << numAtlases << (numAtlases == 1 ? " atlas" : " atlases")
+              << std::endl;
+    return 0;
+  }
+
+  // Only Y4M streams benefit from converting on the GPU: readback shrinks from 4 to 1.5 bytes per pixel
+  std::unique_ptr<YUV420PassState> yuvPass;
+  if (argGpuYuv) {
+    if (argFrames == 0 || writeSequence || streamFormat != StreamFormat::Y4M) {
+      std::cerr << "--gpu-yuv only applies to Y4M streams, ignoring" << std::endl;
+    } else if (!argRoi.empty()) {
+      std::cerr << "--gpu-yuv doesn't support --roi, converting on the CPU" << std::endl;
+    } else if (resolveFbo) {
+      std::cerr << "--gpu-yuv doesn't support --samples, converting on the CPU" << std::endl;
+    } else if (!fbo || argRenderMode != "modern" || glMajor < 3) {
+      std::cerr << "GPU YUV conversion needs an offscreen OpenGL 3 or GLES 3 context, converting on the CPU" << std::endl;
+    } else {
+      yuvPass = std::make_unique<YUV420PassState>();
+      if (!setupYUV420Pass(*yuvPass, glslVersion, ctx->width(), ctx->height())) {
+        std::cerr << "Converting on the CPU" << std::endl;
+        yuvPass.reset();
       }
+    }
+  }
+  const int readWidth = yuvPass ? yuvPass->targetWidth() : ctx->width();
+  const int readHeight = yuvPass ? yuvPass->targetHeight() : ctx->height();
+
+  std::unique_ptr<AsyncReadback> readback;
+  if (argAsyncReadback) {
+    readback = createAsyncReadback(*ctx, argFrames > 0 ? 3 : 2,
+                                   yuvPass ? PixelRect{0, 0, readWidth, readHeight} : readRect);
+    if (!readback) std::cerr << "Falling back to synchronous readback" << std::endl;
+  }
+
+  std::unique_ptr<DirtyRegionTracker> dirtyTracker;
+  if (argDirtyTiles > 0) {
+    if (argFrames == 0) {
+      std::cerr << "--dirty-tiles only applies to --frames, ignoring" << std::endl;
+    } else if (readback || yuvPass) {
+      std::cerr << "--dirty-tiles needs synchronous readback without --gpu-yuv, ignoring" << std::endl;
     } else {
-      if (glMajor >= 3) {
-        glslVersion = "300 es";
-      } else if (glMajor == 2) {
-        glslVersion = "100 es";
+      dirtyTracker = createDirtyRegionTracker(*ctx, glslVersion, readRect, argDirtyTiles);
+      if (!dirtyTracker) std::cerr << "Reading back whole frames" << std::endl;
+    }
+  }
+
+  const auto renderFrame = [&]() {
+    if (gpuProfiler) gpuProfiler->markFrame();
+    if (argStaticScene) std::srand(sceneSeed);
+    GL_CHECK(render());
+    resolve(ctx->width(), ctx->height());
+    if (yuvPass) {
+      renderYUV420Pass(*yuvPass);  // Flips rows itself
+    } else if (flipFbo) {
+      fbo->blitTo(*flipFbo, ctx->width(), ctx->height(), /*flipY*/ true);
+    }
+  };
+
+  if (argBench) {
+    std::function<bool(PixelBuffer&)> readFrame;
+    std::function<bool(const PixelBuffer&)> encodeFrame;
+    if (!argOut.empty()) {
+      readFrame = [&](PixelBuffer& buffer) { return ctx->getFramebuffer(readRect, buffer); };
+      encodeFrame = [&](const PixelBuffer& buffer) {
+        return writeFramebuffer(readRect, buffer, argOut.c_str(), outputOptions);
+      };
+    }
+    PhaseTimer timer("Benchmark");
+    if (!benchmarkFrames(argFrames, argWarmup, renderFrame, readFrame, encodeFrame)) {
+      std::cerr << "Unable to write frames to " << argOut << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  if (argFrames > 0) {
+    std::unique_ptr<FrameSink> sink;
+    // The Y4M converter reads BGRA just as well, so skip the swizzle. Async readback swizzles for free while copying.
+    const bool nativeOrder = !writeSequence && streamFormat == StreamFormat::Y4M && !readback;
+    std::unique_ptr<OffscreenContextPool> pool;
+    if (argRenderThreads > 1) {
+      if (!writeSequence) {
+        std::cerr << "--render-threads only applies to image sequences, ignoring" << std::endl;
+      } else if (readback || dirtyTracker || !fbo) {
+        std::cerr << "--render-threads needs an offscreen context, without --async-readback or --dirty-tiles, "
+                  << "rendering on one thread" << std::endl;
+      } else {
+        pool = createOffscreenContextPool(argContextProvider, ctx, argRenderThreads);
+        if (!pool) std::cerr << "Rendering on one thread" << std::endl;
       }
     }
-    if (requestGLES || glMajor >= 3) {
-      setup = [&states, &glslVersion]() { setupModernOGL3(states, glslVersion); };
-      render = [&states]() { renderModernOGL3(states); };
+    if (writeSequence) {
+      // Enough buffers to keep every writer busy while the next frames render
+      const unsigned int numRenderThreads = pool ? pool->size() : 1;
+      auto sequence = std::make_unique<ImageSequenceSink>(argOut, roi.width, roi.height, outputOptions,
+                                                          argWriterThreads, argWriterThreads + numRenderThreads + 1);
+      sequence->setSkipDuplicates(argSkipDuplicates);
+      sink = std::move(sequence);
+    } else {
+      auto stream = createFrameStream(argOut, roi.width, roi.height, streamFormat, argFps,
+                                      outputOptions.bottomUp);
+      if (!stream) return 1;
+      stream->setI420Input(yuvPass != nullptr);
+      stream->setBGRAInput(nativeOrder && ctx->readsBGRA());
+      // Only the RGBA to I420 conversion is skipped, which raw streams and GPU converted frames don't do
+      if (argSkipDuplicates && (streamFormat != StreamFormat::Y4M || yuvPass)) {
+        std::cerr << "--skip-duplicates only applies to image sequences and Y4M streams converted on the CPU, "
+                  << "ignoring" << std::endl;
+        argSkipDuplicates = false;
+      }
+      stream->setSkipDuplicates(argSkipDuplicates);
+      sink = std::move(stream);
+    }
+    // With dirty tiles, changed regions are patched into the last frame, which is then handed out as a copy
+    PixelBuffer lastFrame;
+    std::vector<PixelRect> dirtyRegions;
+    size_t tilesRead = 0;
+    const auto readFrame = [&](PixelBuffer& buffer) {
+      if (yuvPass) {
+        buffer.resize(4 * static_cast<size_t>(readWidth) * readHeight);
+        GL_CHECK(glReadPixels(0, 0, readWidth, readHeight, GL_RGBA, GL_UNSIGNED_BYTE, buffer.data()));
+        return true;
+      }
+      if (!dirtyTracker) return ctx->getFramebuffer(readRect, buffer, /*convertToRGBA*/ !nativeOrder);
+
+      lastFrame.resize(4 * static_cast<size_t>(readRect.width) * readRect.height);
+      dirtyRegions.clear();
+      for (const auto& rect : dirtyTracker->update()) {
+        const PixelRect local = {rect.x - readRect.x, rect.y - readRect.y, rect.width, rect.height};
+        uint8_t *dst = lastFrame.data() + 4 * (static_cast<size_t>(local.y) * readRect.width + local.x);
+        if (!ctx->readPixels(rect, dst, readRect.width, /*convertToRGBA*/ !nativeOrder)) return false;
+        dirtyRegions.push_back(local);
+      }
+      tilesRead += dirtyTracker->lastDirtyTiles();
+      buffer.resize(lastFrame.size());
+      memcpy(buffer.data(), lastFrame.data(), lastFrame.size());
+      return true;
+    };
+    // Each worker gets its own FBOs and vertex arrays, and shares the programs and buffers set up above
+    const auto setupWorker = [&](OpenGLContext& workerCtx) -> std::function<bool(PixelBuffer&)> {
+      std::shared_ptr<FBO> workerFbo = createFBO(workerCtx, argSamples);
+      if (!workerFbo) return {};
+      std::shared_ptr<FBO> readFbo;
+      if (resolveFbo || flipFbo) {
+        readFbo = createBlitFBO(workerCtx);
+        if (!readFbo) return {};
+        readFbo->unbind();
+      }
+      std::vector<MyState> workerStates;
+      if (argRenderMode != "immediate") {
+        workerStates = modernOGL3 ? shareModernOGL3(states) : shareModernOGL2(states);
+      }
+      GL_CHECK(glViewport(0, 0, workerCtx.width(), workerCtx.height()));
+      workerCtx.queryReadFormat();
+      return [&, workerFbo, readFbo, workerStates](PixelBuffer& buffer) {
+        // std::rand() is shared by all workers, so nobody may draw between reseeding and rendering
+        std::unique_lock<std::mutex> seedLock(sceneSeedMutex, std::defer_lock);
+        if (argStaticScene) {
+          seedLock.lock();
+          std::srand(sceneSeed);
+        }
+        if (argRenderMode == "immediate") {
+          GL_CHECK(renderImmediate());
+        } else if (modernOGL3) {
+          GL_CHECK(renderModernOGL3(workerStates));
+        } else {
+          GL_CHECK(renderModernOGL2(workerStates));
+        }
+        if (seedLock.owns_lock()) seedLock.unlock();
+        if (readFbo) workerFbo->blitTo(*readFbo, workerCtx.width(), workerCtx.height(), /*flipY*/ flipFbo != nullptr);
+        return workerCtx.getFramebuffer(readRect, buffer);
+      };
+    };
+    PhaseTimer framesTimer("Render frames");
+    bool rendered;
+    if (pool) {
+      std::cout << "Rendering on " << pool->size() << " threads" << std::endl;
+      ctx->releaseCurrent();
+      rendered = renderFramesParallel(*pool, argFrames, setupWorker, *sink);
+      ctx->makeCurrent();
     } else {
-      setup = [&states, &glslVersion]() { setupModernOGL2(states, glslVersion); };
-      render = [&states]() { renderModernOGL2(states); };
+      rendered = renderFrames(argFrames, renderFrame, readFrame, dirtyTracker ? &dirtyRegions : nullptr,
+                              readback.get(), *sink);
+    }
+    if (dirtyTracker) {
+      std::cout << "Read back " << tilesRead << " of " << argFrames * dirtyTracker->numTiles() << " tiles" << std::endl;
+    }
+    const bool finished = sink->finish();
+    framesTimer.stop();
+    if (!finished || !rendered) {
+      std::cerr << "Unable to write frames to " << argOut << std::endl;
+      return 1;
     }
+    if (argSkipDuplicates || dirtyTracker) {
+      std::cout << "Skipped " << sink->framesSkipped() << " of " << argFrames << " frames as duplicates" << std::endl;
+    }
+    return 0;
   }
 
-  GL_CHECK(setup());
 #ifdef ENABLE_GLFW
   if (const auto glfwContext = std::dynamic_pointer_cast<GLFWContext>(ctx)) {
     glfwContext->loop(render);
@@ -333,12 +1118,27 @@ int main(int argc, char *argv[])
   else
 #endif
   {
+    PhaseTimer timer("First draw");
     GL_CHECK(render());
+    // Otherwise the draw would be counted as readback
+    if (phaseTimingsEnabled()) glFinish();
   }
 
   if (!argOut.empty()) {
-    glFinish();
-    if (!saveFramebuffer(*ctx, argOut.c_str())) {
+    PhaseTimer blitTimer("Resolve and flip");
+    resolve(ctx->width(), ctx->height());
+    if (flipFbo) fbo->blitTo(*flipFbo, ctx->width(), ctx->height(), /*flipY*/ true);
+    if (phaseTimingsEnabled()) glFinish();
+    blitTimer.stop();
+    PixelBuffer buffer;
+    bool saved;
+    if (readback) {
+      saved = saveFramebufferAsync(*readback, readRect, buffer, argOut.c_str(), outputOptions);
+    } else {
+      glFinish();
+      saved = saveFramebuffer(*ctx, readRect, buffer, argOut.c_str(), outputOptions);
+    }
+    if (!saved) {
       std::cerr << "Unable to write framebuffer to " << argOut << std::endl;
     }
   }
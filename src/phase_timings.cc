@@ -0,0 +1,105 @@
+#include "phase_timings.h"
+
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <vector>
+
+bool phaseTimingsEnabledFlag = false;
+
+namespace {
+
+struct Phase {
+  std::string name;
+  int depth;
+  std::chrono::steady_clock::duration total{};
+  int count = 0;
+};
+
+std::mutex phasesMutex;
+// In the order they were first seen
+std::vector<Phase> phases;
+std::chrono::steady_clock::time_point enabledTime;
+// Nesting of running timers on this thread
+thread_local int currentDepth = 0;
+
+double toMs(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+}  // namespace
+
+void enablePhaseTimings()
+{
+  enabledTime = std::chrono::steady_clock::now();
+  phaseTimingsEnabledFlag = true;
+}
+
+void PhaseTimer::begin()
+{
+  this->depth = currentDepth++;
+  {
+    // Listed in the order they start, so nested phases follow their parent
+    std::lock_guard<std::mutex> lock(phasesMutex);
+    bool found = false;
+    for (const auto& phase : phases) {
+      if (phase.name == this->name) {
+        found = true;
+        break;
+      }
+    }
+    if (!found) phases.push_back({this->name, this->depth});
+  }
+  this->start = std::chrono::steady_clock::now();
+}
+
+void PhaseTimer::end()
+{
+  this->running = false;
+  const auto duration = std::chrono::steady_clock::now() - this->start;
+  currentDepth--;
+
+  std::lock_guard<std::mutex> lock(phasesMutex);
+  for (auto& phase : phases) {
+    if (phase.name == this->name) {
+      phase.total += duration;
+      phase.count++;
+      return;
+    }
+  }
+}
+
+void printPhaseTimings(std::ostream& os, bool json)
+{
+  std::lock_guard<std::mutex> lock(phasesMutex);
+  const auto total = std::chrono::steady_clock::now() - enabledTime;
+  std::chrono::steady_clock::duration timed{};
+  for (const auto& phase : phases) {
+    if (phase.depth == 0) timed += phase.total;
+  }
+
+  const auto oldFlags = os.flags();
+  const auto oldPrecision = os.precision();
+  os << std::fixed << std::setprecision(3);
+  if (json) {
+    os << "{\"total_ms\": " << toMs(total) << ", \"untimed_ms\": " << toMs(total - timed) << ", \"phases\": [";
+    for (size_t i = 0; i < phases.size(); i++) {
+      const auto& phase = phases[i];
+      os << (i > 0 ? ", " : "") << "{\"name\": \"" << phase.name << "\", \"depth\": " << phase.depth
+         << ", \"ms\": " << toMs(phase.total) << ", \"count\": " << phase.count << "}";
+    }
+    os << "]}" << std::endl;
+  } else {
+    os << "Timings:\n";
+    for (const auto& phase : phases) {
+      const std::string name = std::string(2 * phase.depth, ' ') + phase.name;
+      os << "  " << std::left << std::setw(32) << name << std::right << std::setw(10) << toMs(phase.total) << " ms";
+      if (phase.count > 1) os << "  (" << phase.count << "x)";
+      os << "\n";
+    }
+    os << "  " << std::left << std::setw(32) << "Untimed" << std::right << std::setw(10) << toMs(total - timed) << " ms\n";
+    os << "  " << std::left << std::setw(32) << "Total" << std::right << std::setw(10) << toMs(total) << " ms" << std::endl;
+  }
+  os.flags(oldFlags);
+  os.precision(oldPrecision);
+}
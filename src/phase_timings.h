@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+#include <ostream>
+
+// Built-in timers for startup phases, see --timings.
+// They record nothing until enablePhaseTimings() is called, a disabled PhaseTimer is a single branch.
+
+extern bool phaseTimingsEnabledFlag;
+inline bool phaseTimingsEnabled() { return phaseTimingsEnabledFlag; }
+// Starts the clock for the total shown by printPhaseTimings()
+void enablePhaseTimings();
+// Prints each phase's total time and count, phases timed within others indented below them
+void printPhaseTimings(std::ostream& os, bool json);
+
+// Times its scope as a phase. Repeated phases add up.
+class PhaseTimer
+{
+  const char *name;
+  bool running;
+  int depth = 0;
+  std::chrono::steady_clock::time_point start;
+
+  void begin();
+  void end();
+
+public:
+  explicit PhaseTimer(const char *name) : name(name), running(phaseTimingsEnabled()) {
+    if (this->running) begin();
+  }
+  ~PhaseTimer() { stop(); }
+  // Ends the phase before the end of the scope
+  void stop() {
+    if (this->running) end();
+  }
+};
@@ -0,0 +1,490 @@
+#include "pixel_convert.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#include <immintrin.h>
+#define PIXEL_CONVERT_X86
+// AVX2 variants are compiled with a target attribute, so the rest of the build stays baseline
+#if defined(__GNUC__) || defined(__clang__)
+#define PIXEL_CONVERT_AVX2
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PIXEL_CONVERT_NEON
+#endif
+
+namespace {
+
+// Exact x / 255 for x in [0, 255 * 255], rounded to nearest
+inline uint8_t div255(unsigned int x)
+{
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+struct Kernels {
+  void (*swizzleRB)(const uint8_t *, uint8_t *, size_t);
+  void (*rgbaToRGB)(const uint8_t *, uint8_t *, size_t);
+  void (*premultiply)(const uint8_t *, uint8_t *, size_t);
+  void (*unpremultiply)(const uint8_t *, uint8_t *, size_t);
+  void (*swapBytes)(uint8_t *, uint8_t *, size_t);
+};
+
+// Scalar
+
+void swizzleRBScalar(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  for (size_t i = 0; i < numPixels; ++i) {
+    const uint8_t *s = src + 4 * i;
+    uint8_t *d = dst + 4 * i;
+    const uint8_t first = s[0];
+    const uint8_t third = s[2];
+    d[0] = third;
+    d[1] = s[1];
+    d[2] = first;
+    d[3] = s[3];
+  }
+}
+
+void rgbaToRGBScalar(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  for (size_t i = 0; i < numPixels; ++i) {
+    dst[3 * i + 0] = src[4 * i + 0];
+    dst[3 * i + 1] = src[4 * i + 1];
+    dst[3 * i + 2] = src[4 * i + 2];
+  }
+}
+
+void premultiplyScalar(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  for (size_t i = 0; i < numPixels; ++i) {
+    const unsigned int a = src[4 * i + 3];
+    dst[4 * i + 0] = div255(src[4 * i + 0] * a);
+    dst[4 * i + 1] = div255(src[4 * i + 1] * a);
+    dst[4 * i + 2] = div255(src[4 * i + 2] * a);
+    dst[4 * i + 3] = a;
+  }
+}
+
+void unpremultiplyScalar(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  for (size_t i = 0; i < numPixels; ++i) {
+    const unsigned int a = src[4 * i + 3];
+    for (int c = 0; c < 3; ++c) {
+      // floor(c * 255 / a + 0.5), like the vector variants
+      dst[4 * i + c] = a == 0 ? 0 : std::min(255u, (2 * 255 * src[4 * i + c] + a) / (2 * a));
+    }
+    dst[4 * i + 3] = a;
+  }
+}
+
+void swapBytesScalar(uint8_t *a, uint8_t *b, size_t size)
+{
+  uint8_t tmp[256];
+  while (size > 0) {
+    const size_t chunk = std::min(size, sizeof(tmp));
+    memcpy(tmp, a, chunk);
+    memcpy(a, b, chunk);
+    memcpy(b, tmp, chunk);
+    a += chunk;
+    b += chunk;
+    size -= chunk;
+  }
+}
+
+constexpr Kernels scalarKernels = {
+  swizzleRBScalar, rgbaToRGBScalar, premultiplyScalar, unpremultiplyScalar, swapBytesScalar,
+};
+
+#ifdef PIXEL_CONVERT_X86
+
+// SSE2
+
+void swizzleRBSSE2(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  // No byte shuffle in SSE2: keep G and A, exchange the bytes at bit 0 and bit 16 of each 32-bit lane
+  const __m128i maskGA = _mm_set1_epi32(static_cast<int>(0xff00ff00));
+  const __m128i maskLow = _mm_set1_epi32(0x000000ff);
+  size_t i = 0;
+  for (; i + 4 <= numPixels; i += 4) {
+    const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4 * i));
+    const __m128i ga = _mm_and_si128(px, maskGA);
+    const __m128i first = _mm_and_si128(px, maskLow);
+    const __m128i third = _mm_and_si128(_mm_srli_epi32(px, 16), maskLow);
+    const __m128i out = _mm_or_si128(ga, _mm_or_si128(third, _mm_slli_epi32(first, 16)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i), out);
+  }
+  swizzleRBScalar(src + 4 * i, dst + 4 * i, numPixels - i);
+}
+
+// Multiplies 8 16-bit channels by the alpha of their pixel, dividing by 255 with rounding
+inline __m128i premultiply8SSE2(__m128i px16)
+{
+  // Broadcast each pixel's alpha (word 3 and 7) over its four words
+  __m128i alpha = _mm_shufflelo_epi16(px16, _MM_SHUFFLE(3, 3, 3, 3));
+  alpha = _mm_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+  __m128i x = _mm_add_epi16(_mm_mullo_epi16(px16, alpha), _mm_set1_epi16(128));
+  x = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+  // Keep the original alpha
+  const __m128i alphaMask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+  return _mm_or_si128(_mm_andnot_si128(alphaMask, x), _mm_and_si128(alphaMask, px16));
+}
+
+void premultiplySSE2(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= numPixels; i += 4) {
+    const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4 * i));
+    const __m128i lo = premultiply8SSE2(_mm_unpacklo_epi8(px, zero));
+    const __m128i hi = premultiply8SSE2(_mm_unpackhi_epi8(px, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i), _mm_packus_epi16(lo, hi));
+  }
+  premultiplyScalar(src + 4 * i, dst + 4 * i, numPixels - i);
+}
+
+// One pixel per float vector
+inline __m128i unpremultiply1SSE2(__m128i px32)
+{
+  const __m128 c = _mm_cvtepi32_ps(px32);
+  const __m128 a = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 3, 3));
+  __m128 x = _mm_add_ps(_mm_div_ps(_mm_mul_ps(c, _mm_set1_ps(255.0f)), a), _mm_set1_ps(0.5f));
+  x = _mm_min_ps(x, _mm_set1_ps(255.0f));
+  // Zero alpha gives inf or NaN, which compare unequal to themselves or fail the min
+  x = _mm_and_ps(x, _mm_cmpneq_ps(a, _mm_setzero_ps()));
+  __m128i out = _mm_cvttps_epi32(x);
+  const __m128i alphaMask = _mm_set_epi32(-1, 0, 0, 0);
+  return _mm_or_si128(_mm_andnot_si128(alphaMask, out), _mm_and_si128(alphaMask, px32));
+}
+
+void unpremultiplySSE2(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= numPixels; i += 4) {
+    const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4 * i));
+    const __m128i lo16 = _mm_unpacklo_epi8(px, zero);
+    const __m128i hi16 = _mm_unpackhi_epi8(px, zero);
+    const __m128i p0 = unpremultiply1SSE2(_mm_unpacklo_epi16(lo16, zero));
+    const __m128i p1 = unpremultiply1SSE2(_mm_unpackhi_epi16(lo16, zero));
+    const __m128i p2 = unpremultiply1SSE2(_mm_unpacklo_epi16(hi16, zero));
+    const __m128i p3 = unpremultiply1SSE2(_mm_unpackhi_epi16(hi16, zero));
+    const __m128i out = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i), out);
+  }
+  unpremultiplyScalar(src + 4 * i, dst + 4 * i, numPixels - i);
+}
+
+void swapBytesSSE2(uint8_t *a, uint8_t *b, size_t size)
+{
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+    const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(a + i), vb);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(b + i), va);
+  }
+  swapBytesScalar(a + i, b + i, size - i);
+}
+
+// SSE2 has no byte shuffle to pack RGB, the scalar loop is as good
+constexpr Kernels sse2Kernels = {
+  swizzleRBSSE2, rgbaToRGBScalar, premultiplySSE2, unpremultiplySSE2, swapBytesSSE2,
+};
+
+#ifdef PIXEL_CONVERT_AVX2
+
+// AVX2
+
+AVX2_TARGET void swizzleRBAVX2(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                           2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+  size_t i = 0;
+  for (; i + 8 <= numPixels; i += 8) {
+    const __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 4 * i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 4 * i), _mm256_shuffle_epi8(px, shuffle));
+  }
+  swizzleRBScalar(src + 4 * i, dst + 4 * i, numPixels - i);
+}
+
+AVX2_TARGET void rgbaToRGBAVX2(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  // Pack 12 bytes in each 128-bit lane, then move the lanes' 24 bytes together
+  const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                           0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  const __m256i permute = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+  size_t i = 0;
+  // Each store writes 32 bytes of which 24 are used, so stop while there's room for the excess
+  for (; i + 11 <= numPixels; i += 8) {
+    const __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 4 * i));
+    const __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(px, shuffle), permute);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 3 * i), packed);
+  }
+  rgbaToRGBScalar(src + 4 * i, dst + 3 * i, numPixels - i);
+}
+
+// Multiplies 16 16-bit channels by the alpha of their pixel, dividing by 255 with rounding
+AVX2_TARGET inline __m256i premultiply16AVX2(__m256i px16)
+{
+  const __m256i alphaShuffle = _mm256_setr_epi8(6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15,
+                                                6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15);
+  const __m256i alphaMask = _mm256_set1_epi64x(static_cast<long long>(0xffff000000000000ULL));
+  const __m256i alpha = _mm256_shuffle_epi8(px16, alphaShuffle);
+  __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(px16, alpha), _mm256_set1_epi16(128));
+  x = _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+  return _mm256_blendv_epi8(x, px16, alphaMask);
+}
+
+AVX2_TARGET void premultiplyAVX2(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= numPixels; i += 8) {
+    const __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 4 * i));
+    // unpack and pack work per 128-bit lane, so the pixel order is preserved
+    const __m256i lo = premultiply16AVX2(_mm256_unpacklo_epi8(px, zero));
+    const __m256i hi = premultiply16AVX2(_mm256_unpackhi_epi8(px, zero));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 4 * i), _mm256_packus_epi16(lo, hi));
+  }
+  premultiplyScalar(src + 4 * i, dst + 4 * i, numPixels - i);
+}
+
+// Two pixels per float vector
+AVX2_TARGET inline __m256i unpremultiply2AVX2(__m256i px32)
+{
+  const __m256i alphaIndex = _mm256_setr_epi32(3, 3, 3, 3, 7, 7, 7, 7);
+  const __m256i alphaMask = _mm256_setr_epi32(0, 0, 0, -1, 0, 0, 0, -1);
+  const __m256 c = _mm256_cvtepi32_ps(px32);
+  const __m256 a = _mm256_permutevar8x32_ps(c, alphaIndex);
+  __m256 x = _mm256_add_ps(_mm256_div_ps(_mm256_mul_ps(c, _mm256_set1_ps(255.0f)), a), _mm256_set1_ps(0.5f));
+  x = _mm256_min_ps(x, _mm256_set1_ps(255.0f));
+  x = _mm256_and_ps(x, _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_NEQ_OQ));
+  return _mm256_blendv_epi8(_mm256_cvttps_epi32(x), px32, alphaMask);
+}
+
+AVX2_TARGET void unpremultiplyAVX2(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  const __m256i unpackOrder = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  size_t i = 0;
+  for (; i + 8 <= numPixels; i += 8) {
+    __m256i px[4];
+    for (int j = 0; j < 4; ++j) {
+      const __m128i pair = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + 4 * i + 8 * j));
+      px[j] = unpremultiply2AVX2(_mm256_cvtepu8_epi32(pair));
+    }
+    // Packing interleaves the 128-bit lanes; undo that at the end
+    const __m256i words0 = _mm256_packs_epi32(px[0], px[1]);
+    const __m256i words1 = _mm256_packs_epi32(px[2], px[3]);
+    const __m256i out = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(words0, words1), unpackOrder);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 4 * i), out);
+  }
+  unpremultiplyScalar(src + 4 * i, dst + 4 * i, numPixels - i);
+}
+
+AVX2_TARGET void swapBytesAVX2(uint8_t *a, uint8_t *b, size_t size)
+{
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+    const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(a + i), vb);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(b + i), va);
+  }
+  swapBytesScalar(a + i, b + i, size - i);
+}
+
+constexpr Kernels avx2Kernels = {
+  swizzleRBAVX2, rgbaToRGBAVX2, premultiplyAVX2, unpremultiplyAVX2, swapBytesAVX2,
+};
+
+#endif // PIXEL_CONVERT_AVX2
+#endif // PIXEL_CONVERT_X86
+
+#ifdef PIXEL_CONVERT_NEON
+
+// NEON
+
+void swizzleRBNEON(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  size_t i = 0;
+  for (; i + 16 <= numPixels; i += 16) {
+    uint8x16x4_t px = vld4q_u8(src + 4 * i);
+    const uint8x16_t tmp = px.val[0];
+    px.val[0] = px.val[2];
+    px.val[2] = tmp;
+    vst4q_u8(dst + 4 * i, px);
+  }
+  swizzleRBScalar(src + 4 * i, dst + 4 * i, numPixels - i);
+}
+
+void rgbaToRGBNEON(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  size_t i = 0;
+  for (; i + 16 <= numPixels; i += 16) {
+    const uint8x16x4_t px = vld4q_u8(src + 4 * i);
+    const uint8x16x3_t rgb = {{px.val[0], px.val[1], px.val[2]}};
+    vst3q_u8(dst + 3 * i, rgb);
+  }
+  rgbaToRGBScalar(src + 4 * i, dst + 3 * i, numPixels - i);
+}
+
+// (x + 128 + ((x + 128) >> 8)) >> 8, with rounding shifts
+inline uint8x8_t div255NEON(uint16x8_t x)
+{
+  return vraddhn_u16(x, vrshrq_n_u16(x, 8));
+}
+
+void premultiplyNEON(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  size_t i = 0;
+  for (; i + 8 <= numPixels; i += 8) {
+    uint8x8x4_t px = vld4_u8(src + 4 * i);
+    px.val[0] = div255NEON(vmull_u8(px.val[0], px.val[3]));
+    px.val[1] = div255NEON(vmull_u8(px.val[1], px.val[3]));
+    px.val[2] = div255NEON(vmull_u8(px.val[2], px.val[3]));
+    vst4_u8(dst + 4 * i, px);
+  }
+  premultiplyScalar(src + 4 * i, dst + 4 * i, numPixels - i);
+}
+
+void swapBytesNEON(uint8_t *a, uint8_t *b, size_t size)
+{
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const uint8x16_t va = vld1q_u8(a + i);
+    const uint8x16_t vb = vld1q_u8(b + i);
+    vst1q_u8(a + i, vb);
+    vst1q_u8(b + i, va);
+  }
+  swapBytesScalar(a + i, b + i, size - i);
+}
+
+// Unpremultiplying needs a vector divide, which 32-bit ARM lacks
+constexpr Kernels neonKernels = {
+  swizzleRBNEON, rgbaToRGBNEON, premultiplyNEON, unpremultiplyScalar, swapBytesNEON,
+};
+
+#endif // PIXEL_CONVERT_NEON
+
+const Kernels *kernelsFor(PixelISA isa)
+{
+  switch (isa) {
+#ifdef PIXEL_CONVERT_X86
+  case PixelISA::SSE2:
+    return &sse2Kernels;
+#ifdef PIXEL_CONVERT_AVX2
+  case PixelISA::AVX2:
+    return &avx2Kernels;
+#endif
+#endif
+#ifdef PIXEL_CONVERT_NEON
+  case PixelISA::NEON:
+    return &neonKernels;
+#endif
+  default:
+    return &scalarKernels;
+  }
+}
+
+// Picked on first use rather than by a static initializer, which could run before those of the
+// CPU feature detection or of other translation units converting pixels
+constexpr int unselectedISA = -1;
+std::atomic<int> activeISA{unselectedISA};
+
+PixelISA selectedISA()
+{
+  int isa = activeISA.load(std::memory_order_relaxed);
+  if (isa == unselectedISA) {
+    const int best = static_cast<int>(supportedPixelISAs().back());
+    // Unless setPixelISA() got there first
+    isa = activeISA.compare_exchange_strong(isa, best) ? best : isa;
+  }
+  return static_cast<PixelISA>(isa);
+}
+
+inline const Kernels& kernels()
+{
+  return *kernelsFor(selectedISA());
+}
+
+} // namespace
+
+std::vector<PixelISA> supportedPixelISAs()
+{
+  std::vector<PixelISA> isas = {PixelISA::Scalar};
+#ifdef PIXEL_CONVERT_X86
+  // SSE2 is part of x86-64, and assumed on 32-bit x86 as well
+  isas.push_back(PixelISA::SSE2);
+#ifdef PIXEL_CONVERT_AVX2
+  // Normally done by a constructor in libgcc, which may not have run yet
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) isas.push_back(PixelISA::AVX2);
+#endif
+#endif
+#ifdef PIXEL_CONVERT_NEON
+  isas.push_back(PixelISA::NEON);
+#endif
+  return isas;
+}
+
+PixelISA activePixelISA()
+{
+  return selectedISA();
+}
+
+bool setPixelISA(PixelISA isa)
+{
+  const auto isas = supportedPixelISAs();
+  if (std::find(isas.begin(), isas.end(), isa) == isas.end()) return false;
+  activeISA.store(static_cast<int>(isa));
+  return true;
+}
+
+const char *pixelISAName(PixelISA isa)
+{
+  switch (isa) {
+  case PixelISA::Scalar: return "scalar";
+  case PixelISA::SSE2: return "sse2";
+  case PixelISA::AVX2: return "avx2";
+  case PixelISA::NEON: return "neon";
+  }
+  return "unknown";
+}
+
+void swizzleRB(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  kernels().swizzleRB(src, dst, numPixels);
+}
+
+void rgbaToRGB(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  // In place, a vector store could overwrite source pixels not loaded yet
+  if (src == dst) {
+    rgbaToRGBScalar(src, dst, numPixels);
+    return;
+  }
+  kernels().rgbaToRGB(src, dst, numPixels);
+}
+
+void premultiplyAlpha(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  kernels().premultiply(src, dst, numPixels);
+}
+
+void unpremultiplyAlpha(const uint8_t *src, uint8_t *dst, size_t numPixels)
+{
+  kernels().unpremultiply(src, dst, numPixels);
+}
+
+void flipRows(uint8_t *data, size_t rowBytes, size_t numRows)
+{
+  const auto swapBytes = kernels().swapBytes;
+  for (size_t top = 0, bottom = numRows - 1; numRows > 1 && top < bottom; ++top, --bottom) {
+    swapBytes(data + top * rowBytes, data + bottom * rowBytes, rowBytes);
+  }
+}
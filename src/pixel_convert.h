@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Pixel conversion kernels for the output path.
+// Each kernel has scalar, SSE2, AVX2 and NEON variants where they pay off; the best one the CPU
+// supports is picked at runtime.
+
+enum class PixelISA {
+  Scalar,
+  SSE2,
+  AVX2,
+  NEON,
+};
+
+// Swaps the first and third byte of numPixels 4-byte pixels, converting BGRA to RGBA and back.
+// src and dst may point to the same memory.
+void swizzleRB(const uint8_t *src, uint8_t *dst, size_t numPixels);
+// Drops the alpha channel: dst receives 3 * numPixels bytes. src and dst may be the same.
+void rgbaToRGB(const uint8_t *src, uint8_t *dst, size_t numPixels);
+// Multiplies color by alpha, rounding to nearest. src and dst may be the same.
+void premultiplyAlpha(const uint8_t *src, uint8_t *dst, size_t numPixels);
+// Divides color by alpha, rounding to nearest and clamping; fully transparent pixels become 0.
+// src and dst may be the same.
+void unpremultiplyAlpha(const uint8_t *src, uint8_t *dst, size_t numPixels);
+// Reverses the order of numRows rows of rowBytes bytes, in place
+void flipRows(uint8_t *data, size_t rowBytes, size_t numRows);
+
+// Instruction sets usable on this CPU, best last
+std::vector<PixelISA> supportedPixelISAs();
+PixelISA activePixelISA();
+// Forces kernels of a given instruction set, e.g. for benchmarking. Returns false if unsupported.
+bool setPixelISA(PixelISA isa);
+const char *pixelISAName(PixelISA isa);
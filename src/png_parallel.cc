@@ -0,0 +1,369 @@
+#include "png_parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+namespace {
+
+constexpr int compressionLevel = 6;
+// Keeps the per-stripe flush overhead negligible for small images
+constexpr size_t minStripeRows = 16;
+// Stripes per thread, for load balancing
+constexpr size_t stripesPerThread = 2;
+constexpr size_t deflateWindowSize = 32768;
+// zlib counts bytes in uInt, and each stripe becomes an IDAT chunk, whose length must stay below 2^31
+constexpr size_t maxStripeBytes = size_t{1} << 30;
+
+struct Stripe {
+  size_t begin;  // Byte offsets into the filtered image
+  size_t end;
+  std::vector<uint8_t> out;
+  uLong adler;
+  bool ok = false;
+};
+
+// Runs fn(0) .. fn(numTasks - 1) on up to numThreads threads, including the calling thread.
+void parallelFor(size_t numTasks, unsigned int numThreads, const std::function<void(size_t)>& fn)
+{
+  std::atomic<size_t> next{0};
+  const auto worker = [&]() {
+    for (size_t i = next++; i < numTasks; i = next++) fn(i);
+  };
+  std::vector<std::thread> threads;
+  const auto numWorkers = std::min<size_t>(std::max(numThreads, 1u), numTasks);
+  for (size_t i = 1; i < numWorkers; ++i) threads.emplace_back(worker);
+  worker();
+  for (auto& thread : threads) thread.join();
+}
+
+void putU32(uint8_t *p, uint32_t value)
+{
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+uint8_t paeth(int a, int b, int c)
+{
+  const int p = a + b - c;
+  const int pa = abs(p - a);
+  const int pb = abs(p - b);
+  const int pc = abs(p - c);
+  if (pa <= pb && pa <= pc) return a;
+  if (pb <= pc) return b;
+  return c;
+}
+
+void filterRow(int filter, const uint8_t *row, const uint8_t *prev, size_t rowBytes, size_t bpp, uint8_t *out)
+{
+  switch (filter) {
+  case 0: // None
+    memcpy(out, row, rowBytes);
+    break;
+  case 1: // Sub
+    for (size_t i = 0; i < bpp; ++i) out[i] = row[i];
+    for (size_t i = bpp; i < rowBytes; ++i) out[i] = row[i] - row[i - bpp];
+    break;
+  case 2: // Up
+    for (size_t i = 0; i < rowBytes; ++i) out[i] = row[i] - prev[i];
+    break;
+  case 3: // Average
+    for (size_t i = 0; i < bpp; ++i) out[i] = row[i] - (prev[i] >> 1);
+    for (size_t i = bpp; i < rowBytes; ++i) out[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+    break;
+  case 4: // Paeth
+    for (size_t i = 0; i < bpp; ++i) out[i] = row[i] - prev[i];
+    for (size_t i = bpp; i < rowBytes; ++i) out[i] = row[i] - paeth(row[i - bpp], prev[i], prev[i - bpp]);
+    break;
+  }
+}
+
+// Picks the filter with the smallest sum of absolute signed residuals, like libpng does.
+// out receives the filter type byte followed by the filtered row.
+void filterRowAdaptive(const uint8_t *row, const uint8_t *prev, size_t rowBytes, size_t bpp,
+                       uint8_t *candidate, uint8_t *out)
+{
+  uint64_t bestSum = UINT64_MAX;
+  for (int filter = 0; filter < 5; ++filter) {
+    filterRow(filter, row, prev, rowBytes, bpp, candidate);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < rowBytes; ++i) sum += abs(static_cast<int8_t>(candidate[i]));
+    if (sum < bestSum) {
+      bestSum = sum;
+      out[0] = filter;
+      memcpy(out + 1, candidate, rowBytes);
+    }
+  }
+}
+
+void filterStripe(const uint8_t *data, size_t height, size_t rowBytes, size_t bpp, bool flip,
+                  size_t firstRow, size_t lastRow, uint8_t *filtered)
+{
+  const auto rowPtr = [&](size_t y) { return data + (flip ? height - 1 - y : y) * rowBytes; };
+  const std::vector<uint8_t> zeroRow(rowBytes, 0);
+  std::vector<uint8_t> candidate(rowBytes);
+  for (size_t y = firstRow; y < lastRow; ++y) {
+    const uint8_t *prev = y > 0 ? rowPtr(y - 1) : zeroRow.data();
+    filterRowAdaptive(rowPtr(y), prev, rowBytes, bpp, candidate.data(), filtered + y * (rowBytes + 1));
+  }
+}
+
+// Deflates one stripe as raw deflate data, primed with the preceding 32k of the image so
+// back-references can cross stripe boundaries. All but the last stripe end with a sync
+// flush, which leaves them byte aligned and non-final so they can simply be concatenated.
+bool deflateStripe(const uint8_t *filtered, bool last, size_t headerBytes, Stripe& stripe)
+{
+  z_stream strm = {};
+  if (deflateInit2(&strm, compressionLevel, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    std::cerr << "deflateInit2() failed" << std::endl;
+    return false;
+  }
+  if (stripe.begin > 0) {
+    const auto dictSize = std::min(stripe.begin, deflateWindowSize);
+    deflateSetDictionary(&strm, filtered + stripe.begin - dictSize, dictSize);
+  }
+
+  const auto length = stripe.end - stripe.begin;
+  stripe.adler = adler32(adler32(0L, Z_NULL, 0), filtered + stripe.begin, length);
+
+  strm.next_in = const_cast<Bytef *>(filtered + stripe.begin);
+  strm.avail_in = length;
+  const auto chunkSize = deflateBound(&strm, length) + 16;
+  size_t produced = headerBytes;
+  int ret;
+  while (true) {
+    stripe.out.resize(produced + chunkSize);
+    strm.next_out = stripe.out.data() + produced;
+    strm.avail_out = chunkSize;
+    ret = deflate(&strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+    produced = headerBytes + strm.total_out;
+    if (ret == Z_STREAM_ERROR) break;
+    if (last ? ret == Z_STREAM_END : strm.avail_out != 0) break;
+  }
+  deflateEnd(&strm);
+  if (ret == Z_STREAM_ERROR) {
+    std::cerr << "deflate() failed" << std::endl;
+    return false;
+  }
+  stripe.out.resize(produced);
+  return true;
+}
+
+bool writeChunk(FILE *f, const char *type, const uint8_t *data, size_t length)
+{
+  uint8_t header[8];
+  putU32(header, length);
+  memcpy(header + 4, type, 4);
+  uLong crc = crc32(0L, Z_NULL, 0);
+  crc = crc32(crc, header + 4, 4);
+  if (length > 0) crc = crc32(crc, data, length);
+  uint8_t footer[4];
+  putU32(footer, crc);
+  return fwrite(header, 1, 8, f) == 8 &&
+    (length == 0 || fwrite(data, 1, length, f) == length) &&
+    fwrite(footer, 1, 4, f) == 4;
+}
+
+bool writeHeader(FILE *f, int width, int height, int samplesPerPixel)
+{
+  static const uint8_t signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  static const uint8_t colorTypes[5] = {0, 0, 4, 2, 6};
+  uint8_t ihdr[13];
+  putU32(ihdr, width);
+  putU32(ihdr + 4, height);
+  ihdr[8] = 8; // bit depth
+  ihdr[9] = colorTypes[samplesPerPixel];
+  ihdr[10] = 0; // deflate
+  ihdr[11] = 0; // adaptive filtering
+  ihdr[12] = 0; // no interlace
+  return fwrite(signature, 1, sizeof(signature), f) == sizeof(signature) &&
+    writeChunk(f, "IHDR", ihdr, sizeof(ihdr));
+}
+
+} // namespace
+
+bool writePNGParallel(const char *filename, int width, int height, int samplesPerPixel,
+                      const uint8_t *data, bool flip, unsigned int numThreads)
+{
+  if (width <= 0 || height <= 0 || samplesPerPixel < 1 || samplesPerPixel > 4) {
+    std::cerr << "writePNGParallel(): Invalid image dimensions" << std::endl;
+    return false;
+  }
+  numThreads = std::max(numThreads, 1u);
+
+  const size_t rowBytes = static_cast<size_t>(width) * samplesPerPixel;
+  const size_t filteredRowBytes = rowBytes + 1;
+  if (filteredRowBytes > maxStripeBytes) {
+    std::cerr << "writePNGParallel(): Rows too wide" << std::endl;
+    return false;
+  }
+  std::vector<uint8_t> filtered(filteredRowBytes * height);
+
+  const size_t maxRowsPerStripe = maxStripeBytes / filteredRowBytes;
+  const size_t numStripes = std::max(std::clamp<size_t>(height / minStripeRows, 1, numThreads * stripesPerThread),
+                                     (height + maxRowsPerStripe - 1) / maxRowsPerStripe);
+  const size_t rowsPerStripe = (height + numStripes - 1) / numStripes;
+  std::vector<Stripe> stripes(numStripes);
+  for (size_t i = 0; i < numStripes; ++i) {
+    const auto firstRow = std::min<size_t>(i * rowsPerStripe, height);
+    const auto lastRow = std::min<size_t>(firstRow + rowsPerStripe, height);
+    stripes[i].begin = firstRow * filteredRowBytes;
+    stripes[i].end = lastRow * filteredRowBytes;
+  }
+
+  // Filtering only reads the unfiltered image, so stripes are independent.
+  // Deflating a stripe reads the tail of the previous one, so we need all of them filtered first.
+  parallelFor(numStripes, numThreads, [&](size_t i) {
+    filterStripe(data, height, rowBytes, samplesPerPixel, flip,
+                 stripes[i].begin / filteredRowBytes, stripes[i].end / filteredRowBytes, filtered.data());
+  });
+  // The first stripe leaves room for the zlib header
+  constexpr size_t zlibHeaderBytes = 2;
+  parallelFor(numStripes, numThreads, [&](size_t i) {
+    stripes[i].ok = deflateStripe(filtered.data(), i == numStripes - 1, i == 0 ? zlibHeaderBytes : 0, stripes[i]);
+  });
+
+  uLong adler = adler32(0L, Z_NULL, 0);
+  for (const auto& stripe : stripes) {
+    if (!stripe.ok) return false;
+    adler = adler32_combine(adler, stripe.adler, stripe.end - stripe.begin);
+  }
+  // CMF: deflate with 32k window, FLG: default compression level, with FCHECK bits
+  stripes.front().out[0] = 0x78;
+  stripes.front().out[1] = 0x9c;
+  uint8_t adlerBytes[4];
+  putU32(adlerBytes, adler);
+  stripes.back().out.insert(stripes.back().out.end(), adlerBytes, adlerBytes + 4);
+
+  FILE *f = fopen(filename, "wb");
+  if (!f) {
+    std::cerr << "Unable to open " << filename << " for writing" << std::endl;
+    return false;
+  }
+
+  bool ok = writeHeader(f, width, height, samplesPerPixel);
+  // One IDAT chunk per stripe; decoders treat consecutive IDATs as one stream
+  for (const auto& stripe : stripes) {
+    ok = ok && writeChunk(f, "IDAT", stripe.out.data(), stripe.out.size());
+  }
+  ok = ok && writeChunk(f, "IEND", nullptr, 0);
+  ok = (fclose(f) == 0) && ok;
+  if (!ok) {
+    std::cerr << "Error writing " << filename << std::endl;
+  }
+  return ok;
+}
+
+struct PNGStreamWriter::State {
+  FILE *file = nullptr;
+  z_stream strm = {};
+  bool deflating = false;
+  size_t rowBytes = 0;
+  size_t bpp = 0;
+  int rowsLeft = 0;
+  std::vector<uint8_t> prev;
+  std::vector<uint8_t> candidate;
+  std::vector<uint8_t> filtered;
+  std::vector<uint8_t> idat;
+};
+
+PNGStreamWriter::PNGStreamWriter() : state(std::make_unique<State>()) {}
+
+PNGStreamWriter::~PNGStreamWriter()
+{
+  if (this->state->deflating) deflateEnd(&this->state->strm);
+  if (this->state->file) fclose(this->state->file);
+}
+
+bool PNGStreamWriter::open(const char *filename, int width, int height, int samplesPerPixel)
+{
+  auto& s = *this->state;
+  if (width <= 0 || height <= 0 || samplesPerPixel < 1 || samplesPerPixel > 4) {
+    std::cerr << "PNGStreamWriter: Invalid image dimensions" << std::endl;
+    return false;
+  }
+  if (deflateInit(&s.strm, compressionLevel) != Z_OK) {
+    std::cerr << "deflateInit() failed" << std::endl;
+    return false;
+  }
+  s.deflating = true;
+  s.file = fopen(filename, "wb");
+  if (!s.file) {
+    std::cerr << "Unable to open " << filename << " for writing" << std::endl;
+    return false;
+  }
+  s.rowBytes = static_cast<size_t>(width) * samplesPerPixel;
+  s.bpp = samplesPerPixel;
+  s.rowsLeft = height;
+  s.prev.assign(s.rowBytes, 0);
+  s.candidate.resize(s.rowBytes);
+  s.filtered.resize(s.rowBytes + 1);
+  if (!writeHeader(s.file, width, height, samplesPerPixel)) {
+    std::cerr << "Error writing " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Deflates input and writes out an IDAT chunk whenever enough compressed data piled up
+bool PNGStreamWriter::deflateData(const uint8_t *data, size_t length, bool last)
+{
+  constexpr size_t idatSize = 1 << 18;
+  auto& s = *this->state;
+  s.strm.next_in = const_cast<Bytef *>(data);
+  s.strm.avail_in = length;
+  while (true) {
+    const size_t produced = s.idat.size();
+    s.idat.resize(produced + idatSize);
+    s.strm.next_out = s.idat.data() + produced;
+    s.strm.avail_out = idatSize;
+    const int ret = deflate(&s.strm, last ? Z_FINISH : Z_NO_FLUSH);
+    s.idat.resize(produced + idatSize - s.strm.avail_out);
+    if (ret == Z_STREAM_ERROR) {
+      std::cerr << "deflate() failed" << std::endl;
+      return false;
+    }
+    if ((last || s.idat.size() >= idatSize) && !s.idat.empty()) {
+      if (!writeChunk(s.file, "IDAT", s.idat.data(), s.idat.size())) return false;
+      s.idat.clear();
+    }
+    if (last ? ret == Z_STREAM_END : s.strm.avail_in == 0 && s.strm.avail_out != 0) return true;
+  }
+}
+
+bool PNGStreamWriter::writeRows(const uint8_t *data, int numRows)
+{
+  auto& s = *this->state;
+  if (!s.file || numRows > s.rowsLeft) return false;
+  for (int y = 0; y < numRows; ++y) {
+    const uint8_t *row = data + y * s.rowBytes;
+    filterRowAdaptive(row, s.prev.data(), s.rowBytes, s.bpp, s.candidate.data(), s.filtered.data());
+    if (!this->deflateData(s.filtered.data(), s.filtered.size(), false)) return false;
+    memcpy(s.prev.data(), row, s.rowBytes);
+  }
+  s.rowsLeft -= numRows;
+  return true;
+}
+
+bool PNGStreamWriter::finish()
+{
+  auto& s = *this->state;
+  if (!s.file) return false;
+  bool ok = s.rowsLeft == 0 && this->deflateData(nullptr, 0, true) && writeChunk(s.file, "IEND", nullptr, 0);
+  ok = (fclose(s.file) == 0) && ok;
+  s.file = nullptr;
+  if (!ok) {
+    std::cerr << "Error writing PNG stream" << std::endl;
+  }
+  return ok;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Writes an 8-bit PNG, filtering and deflating horizontal stripes of the image
+// on numThreads threads. The stripes are joined into a single zlib stream.
+// If flip is set, rows are read bottom-up (OpenGL order).
+bool writePNGParallel(const char *filename, int width, int height, int samplesPerPixel,
+                      const uint8_t *data, bool flip, unsigned int numThreads);
+
+// Writes an 8-bit PNG a few rows at a time, top row first, for images too large to hold in memory.
+class PNGStreamWriter
+{
+  struct State;
+  std::unique_ptr<State> state;
+
+  bool deflateData(const uint8_t *data, size_t length, bool last);
+
+public:
+  PNGStreamWriter();
+  ~PNGStreamWriter();
+  bool open(const char *filename, int width, int height, int samplesPerPixel);
+  bool writeRows(const uint8_t *data, int numRows);
+  // Fails if fewer rows than the image height were written
+  bool finish();
+};
@@ -2,6 +2,7 @@
 
 #include <math.h>
 
+#include "GpuProfiler.h"
 #include "state.h"
 #include "system-gl.h"
 
@@ -49,8 +50,10 @@ const char *perVertexColor_vert_120 = R"(#version 120
 
     varying vec3 ourColor;
 
+    uniform vec4 tileTransform;
+
     void main() {
-      gl_Position = vec4(aPos, 1.0);
+      gl_Position = vec4(aPos.xy * tileTransform.xy + tileTransform.zw, aPos.z, 1.0);
       ourColor = aColor;
     }
   )";
@@ -60,8 +63,10 @@ const char *default_vert_120 = R"(#version 120
 
     varying vec3 ourColor;
 
+    uniform vec4 tileTransform;
+
     void main() {
-      gl_Position = vec4(aPos, 1.0);
+      gl_Position = vec4(aPos.xy * tileTransform.xy + tileTransform.zw, aPos.z, 1.0);
       ourColor = vec3(1,1,1);
     }
   )";
@@ -74,47 +79,13 @@ const char *default_frag_120 = R"(#version 120
     }
   )";
 
-void setupColorWheel(MyState &state) {
-  const char *vertexShaderSource = perVertexColor_vert_120;
-  GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-  glCompileShader(vertexShader);
-  GLint success;
-  char infoLog[512];
-  glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-  if (success != GL_TRUE) {
-    glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-    std::cerr << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-  }
-
-  const char *fragmentShaderSource = default_frag_120;
-  GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-  glCompileShader(fragmentShader);
-  glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-  if (success != GL_TRUE) {
-    glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-    std::cerr << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-  }
-
-  state.shaderProgram = glCreateProgram();
-  glAttachShader(state.shaderProgram, vertexShader);
-  glAttachShader(state.shaderProgram, fragmentShader);
-  GL_CHECK();
-  glBindAttribLocation(state.shaderProgram, 0, "aPos");
-  glBindAttribLocation(state.shaderProgram, 1, "aColor");
-  GL_CHECK();
-  glLinkProgram(state.shaderProgram);
-  glGetProgramiv(state.shaderProgram, GL_LINK_STATUS, &success);
-  if (success != GL_TRUE) {
-    glGetProgramInfoLog(state.shaderProgram, 512, NULL, infoLog);
-    std::cerr << "ERROR::SHADER::PROGRAM::LINK_FAILED\n" << infoLog << std::endl;
-  }
-  glDeleteShader(vertexShader);
-  glDeleteShader(fragmentShader);
+void setupColorWheel(MyState &state, ProgramRegistry &programs) {
+  state.shaderProgram = programs.program(perVertexColor_vert_120, default_frag_120, {"aPos", "aColor"});
 
   GL_CHECK();
   glUseProgram(state.shaderProgram);
+  state.tileTransformLocation = glGetUniformLocation(state.shaderProgram, "tileTransform");
+  glUniform4f(state.tileTransformLocation, 1.0f, 1.0f, 0.0f, 0.0f);
 #ifdef __APPLE__
   GL_CHECK(glGenVertexArraysAPPLE(1, &state.vao));
   GL_CHECK(glBindVertexArrayAPPLE(state.vao));
@@ -123,61 +94,29 @@ void setupColorWheel(MyState &state) {
   GL_CHECK(glBindVertexArray(state.vao));
 #endif
  
-  GLuint vbo;
-  glGenBuffers(1, &vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glGenBuffers(1, &state.vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, state.vbo);
   glBufferData(GL_ARRAY_BUFFER, sizeof(colorWheelVertices), colorWheelVertices, GL_STATIC_DRAW);
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
   glEnableVertexAttribArray(0);
   glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
   glEnableVertexAttribArray(1);
+  state.hasColor = true;
 
-  GLuint ebo;
-  glGenBuffers(1, &ebo);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+  glGenBuffers(1, &state.ebo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, state.ebo);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(colorWheelIndices), colorWheelIndices, GL_STATIC_DRAW);
   GL_CHECK();
   state.numTris = sizeof(colorWheelIndices);
 }
 
-void setupCenter(MyState &state) {
-  const char *vertexShaderSource = default_vert_120;
-  GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-  glCompileShader(vertexShader);
-  GLint success;
-  char infoLog[512];
-  glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-  if (success != GL_TRUE) {
-    glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-    std::cerr << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-  }
-
-  const char *fragmentShaderSource = default_frag_120;
-  GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-  glCompileShader(fragmentShader);
-  glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-  if (success != GL_TRUE) {
-    glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-    std::cerr << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-  }
-
-  state.shaderProgram = glCreateProgram();
-  glAttachShader(state.shaderProgram, vertexShader);
-  glAttachShader(state.shaderProgram, fragmentShader);
-  glBindAttribLocation(state.shaderProgram, 0, "aPos");
-  glLinkProgram(state.shaderProgram);
-  glGetProgramiv(state.shaderProgram, GL_LINK_STATUS, &success);
-  if (success != GL_TRUE) {
-    glGetProgramInfoLog(state.shaderProgram, 512, NULL, infoLog);
-    std::cerr << "ERROR::SHADER::PROGRAM::LINK_FAILED\n" << infoLog << std::endl;
-  }
-  glDeleteShader(vertexShader);
-  glDeleteShader(fragmentShader);
+void setupCenter(MyState &state, ProgramRegistry &programs) {
+  state.shaderProgram = programs.program(default_vert_120, default_frag_120, {"aPos"});
 
   GL_CHECK();
   glUseProgram(state.shaderProgram);
+  state.tileTransformLocation = glGetUniformLocation(state.shaderProgram, "tileTransform");
+  glUniform4f(state.tileTransformLocation, 1.0f, 1.0f, 0.0f, 0.0f);
 #ifdef __APPLE__
   GL_CHECK(glGenVertexArraysAPPLE(1, &state.vao));
   GL_CHECK(glBindVertexArrayAPPLE(state.vao));
@@ -186,16 +125,14 @@ void setupCenter(MyState &state) {
   GL_CHECK(glBindVertexArray(state.vao));
 #endif
 
-  GLuint vbo;
-  glGenBuffers(1, &vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glGenBuffers(1, &state.vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, state.vbo);
   glBufferData(GL_ARRAY_BUFFER, sizeof(centerVertices), centerVertices, GL_STATIC_DRAW);
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
   glEnableVertexAttribArray(0);
 
-  GLuint ebo;
-  glGenBuffers(1, &ebo);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+  glGenBuffers(1, &state.ebo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, state.ebo);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(centerIndices), centerIndices, GL_STATIC_DRAW);
   GL_CHECK();
   state.numTris = sizeof(centerIndices);
@@ -203,20 +140,53 @@ void setupCenter(MyState &state) {
 
 } // namespace
 
-void setupModernOGL2(std::vector<MyState> &states, const std::string &glslVersion) {
+void setupModernOGL2(std::vector<MyState> &states, const std::string &glslVersion, ProgramRegistry &programs) {
   std::cout << "Rendering using modern OpenGL 2" << std::endl;
   std::cout << "Using GLSL " << glslVersion << std::endl;
   states.emplace_back();
-  setupColorWheel(states.back());
+  setupColorWheel(states.back(), programs);
   states.emplace_back();
-  setupCenter(states.back());
+  setupCenter(states.back(), programs);
+}
+
+std::vector<MyState> shareModernOGL2(const std::vector<MyState> &states) {
+  auto shared = states;
+  for (auto& state : shared) {
+#ifdef __APPLE__
+    GL_CHECK(glGenVertexArraysAPPLE(1, &state.vao));
+    GL_CHECK(glBindVertexArrayAPPLE(state.vao));
+#else
+    GL_CHECK(glGenVertexArrays(1, &state.vao));
+    GL_CHECK(glBindVertexArray(state.vao));
+#endif
+    glBindBuffer(GL_ARRAY_BUFFER, state.vbo);
+    const GLsizei stride = (state.hasColor ? 6 : 3) * sizeof(float);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+    glEnableVertexAttribArray(0);
+    if (state.hasColor) {
+      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
+      glEnableVertexAttribArray(1);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, state.ebo);
+    GL_CHECK();
+  }
+  return shared;
 }
 
 void renderModernOGL2(const std::vector<MyState>& states) {
   GL_CHECK(glClearColor(0.4 + 0.6*std::rand()/RAND_MAX, 0.4 + 0.6*std::rand()/RAND_MAX, 0.4 + 0.6*std::rand()/RAND_MAX, 1.0));
-  GL_CHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+  {
+    GpuPass pass("Clear");
+    GL_CHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+  }
+  GpuPass pass("Draw");
+  const MyState *previous = nullptr;
   for (const auto& state : states) {
-    GL_CHECK(glUseProgram(state.shaderProgram));
+    // Consecutive states sharing a program are drawn without switching
+    if (!previous || previous->shaderProgram != state.shaderProgram) {
+      GL_CHECK(glUseProgram(state.shaderProgram));
+    }
+    previous = &state;
 #ifdef __APPLE__
     GL_CHECK(glBindVertexArrayAPPLE(state.vao));
 #else
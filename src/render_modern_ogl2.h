@@ -2,7 +2,11 @@
 
 #include <vector>
 
+#include "ProgramRegistry.h"
 #include "state.h"
 
-void setupModernOGL2(std::vector<MyState> &states, const std::string &glslVersion);
+// See setupModernOGL3()
+void setupModernOGL2(std::vector<MyState> &states, const std::string &glslVersion, ProgramRegistry &programs);
 void renderModernOGL2(const std::vector<MyState>& state);
+// See shareModernOGL3()
+std::vector<MyState> shareModernOGL2(const std::vector<MyState> &states);
@@ -2,6 +2,8 @@
 
 #include <math.h>
 
+#include "GpuProfiler.h"
+#include "shader_cache.h"
 #include "state.h"
 
 namespace {
@@ -48,8 +50,10 @@ const char *perVertexColor_vert_330 = R"(#version 330 core
 
     out vec3 ourColor;
 
+    uniform vec4 tileTransform;
+
     void main() {
-      gl_Position = vec4(aPos, 1.0);
+      gl_Position = vec4(aPos.xy * tileTransform.xy + tileTransform.zw, aPos.z, 1.0);
       ourColor = aColor;
     }
   )";
@@ -60,8 +64,10 @@ const char *perVertexColor_vert_300_es = R"(#version 300 es
 
     out vec3 ourColor;
 
+    uniform vec4 tileTransform;
+
     void main() {
-      gl_Position = vec4(aPos, 1.0);
+      gl_Position = vec4(aPos.xy * tileTransform.xy + tileTransform.zw, aPos.z, 1.0);
       ourColor = aColor;
     }
   )";
@@ -72,8 +78,10 @@ const char *perVertexColor_vert_140 = R"(#version 140
 
     out vec3 ourColor;
 
+    uniform vec4 tileTransform;
+
     void main() {
-      gl_Position = vec4(aPos, 1.0);
+      gl_Position = vec4(aPos.xy * tileTransform.xy + tileTransform.zw, aPos.z, 1.0);
       ourColor = aColor;
     }
   )";
@@ -85,8 +93,10 @@ const char *perVertexColor_vert_100_es = R"(#version 100
 
     varying vec3 ourColor;
 
+    uniform vec4 tileTransform;
+
     void main() {
-      gl_Position = vec4(aPos, 1.0);
+      gl_Position = vec4(aPos.xy * tileTransform.xy + tileTransform.zw, aPos.z, 1.0);
       ourColor = aColor;
     }
   )";
@@ -96,8 +106,10 @@ const char *default_vert_330 = R"(#version 330 core
 
     out vec3 ourColor;
 
+    uniform vec4 tileTransform;
+
     void main() {
-      gl_Position = vec4(aPos, 1.0);
+      gl_Position = vec4(aPos.xy * tileTransform.xy + tileTransform.zw, aPos.z, 1.0);
       ourColor = vec3(1,1,1);
     }
   )";
@@ -107,8 +119,10 @@ const char *default_vert_300_es = R"(#version 300 es
 
     out vec3 ourColor;
 
+    uniform vec4 tileTransform;
+
     void main() {
-      gl_Position = vec4(aPos, 1.0);
+      gl_Position = vec4(aPos.xy * tileTransform.xy + tileTransform.zw, aPos.z, 1.0);
       ourColor = vec3(1,1,1);
     }
   )";
@@ -119,8 +133,10 @@ const char *default_vert_140 = R"(#version 140
 
     out vec3 ourColor;
 
+    uniform vec4 tileTransform;
+
     void main() {
-      gl_Position = vec4(aPos, 1.0);
+      gl_Position = vec4(aPos.xy * tileTransform.xy + tileTransform.zw, aPos.z, 1.0);
       ourColor = vec3(1,1,1);
     }
   )";
@@ -131,8 +147,10 @@ const char *default_vert_100_es = R"(#version 100
 
     varying vec3 ourColor;
 
+    uniform vec4 tileTransform;
+
     void main() {
-      gl_Position = vec4(aPos, 1.0);
+      gl_Position = vec4(aPos.xy * tileTransform.xy + tileTransform.zw, aPos.z, 1.0);
       ourColor = vec3(1,1,1);
     }
   )";
@@ -175,79 +193,87 @@ const char *default_frag_100_es = R"(#version 100
     }
   )";
 
-void setupColorWheel(MyState &state, const std::string &glslVersion) {
+// Full-screen triangle, no vertex attributes needed
+const char *fullscreen_vert_body = R"(
+    void main() {
+      vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+      gl_Position = vec4(pos * 2.0 - 1.0, 0.0, 1.0);
+    }
+  )";
+
+// Each output pixel packs four consecutive bytes of the I420 image:
+// the full-size Y plane followed by the quarter-size U and V planes.
+// The source is in OpenGL's bottom-up order, so rows are flipped while reading.
+const char *yuv420_frag_body = R"(
+    uniform sampler2D source;
+    uniform ivec2 size;
+
+    float lumaAt(int x, int y) {
+      vec3 c = texelFetch(source, ivec2(x, size.y - 1 - y), 0).rgb;
+      return 16.0 / 255.0 + dot(c, vec3(0.2568, 0.5041, 0.0979));
+    }
+
+    vec3 chromaBlock(int cx, int cy) {
+      ivec2 p = ivec2(2 * cx, size.y - 2 - 2 * cy);
+      return 0.25 * (texelFetch(source, p, 0).rgb + texelFetch(source, p + ivec2(1, 0), 0).rgb +
+                     texelFetch(source, p + ivec2(0, 1), 0).rgb + texelFetch(source, p + ivec2(1, 1), 0).rgb);
+    }
+
+    float byteAt(int i) {
+      int lumaSize = size.x * size.y;
+      if (i < lumaSize) return lumaAt(i % size.x, i / size.x);
+      int chromaWidth = size.x / 2;
+      int chromaSize = chromaWidth * (size.y / 2);
+      i -= lumaSize;
+      if (i < chromaSize) {
+        vec3 c = chromaBlock(i % chromaWidth, i / chromaWidth);
+        return 128.0 / 255.0 + dot(c, vec3(-0.1482, -0.2910, 0.4392));
+      }
+      i -= chromaSize;
+      vec3 c = chromaBlock(i % chromaWidth, i / chromaWidth);
+      return 128.0 / 255.0 + dot(c, vec3(0.4392, -0.3678, -0.0714));
+    }
+
+    void main() {
+      ivec2 p = ivec2(gl_FragCoord.xy);
+      int base = 4 * (p.y * (size.x / 4) + p.x);
+      FragColor = vec4(byteAt(base), byteAt(base + 1), byteAt(base + 2), byteAt(base + 3));
+    }
+  )";
+
+void setupColorWheel(MyState &state, const std::string &glslVersion, ProgramRegistry &programs) {
   const char *vertexShaderSource;
-  if (glslVersion == "330") {
-    vertexShaderSource = perVertexColor_vert_330;
-  } else if (glslVersion == "140") {
-    vertexShaderSource = perVertexColor_vert_140;
-  } else if (glslVersion == "300 es") {
-    vertexShaderSource = perVertexColor_vert_300_es;
-  } else if (glslVersion == "100 es") {
-    vertexShaderSource = perVertexColor_vert_100_es;
-  } else {
-    std::cerr << "GLSL " << glslVersion << " shaders not implemented" << std::endl;
-    return;
-  }
-  GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-  glCompileShader(vertexShader);
-  GLint success;
-  char infoLog[512];
-  glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-  if (success != GL_TRUE) {
-    glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-    std::cerr << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-  }
   const char *fragmentShaderSource;
   if (glslVersion == "330") {
+    vertexShaderSource = perVertexColor_vert_330;
     fragmentShaderSource = default_frag_330;
   } else if (glslVersion == "140") {
+    vertexShaderSource = perVertexColor_vert_140;
     fragmentShaderSource = default_frag_140;
   } else if (glslVersion == "300 es") {
+    vertexShaderSource = perVertexColor_vert_300_es;
     fragmentShaderSource = default_frag_300_es;
   } else if (glslVersion == "100 es") {
+    vertexShaderSource = perVertexColor_vert_100_es;
     fragmentShaderSource = default_frag_100_es;
   } else {
     std::cerr << "GLSL " << glslVersion << " shaders not implemented" << std::endl;
     return;
   }
-
-  GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-  glCompileShader(fragmentShader);
-  glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-  if (success != GL_TRUE) {
-    glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-    std::cerr << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-  }
-
-  state.shaderProgram = glCreateProgram();
-  glAttachShader(state.shaderProgram, vertexShader);
-  glAttachShader(state.shaderProgram, fragmentShader);
-  GL_CHECK();
-  if (glslVersion != "330") {
-    glBindAttribLocation(state.shaderProgram, 0, "aPos");
-    glBindAttribLocation(state.shaderProgram, 1, "aColor");
-  }
-  GL_CHECK();
-  glLinkProgram(state.shaderProgram);
-  glGetProgramiv(state.shaderProgram, GL_LINK_STATUS, &success);
-  if (success != GL_TRUE) {
-    glGetProgramInfoLog(state.shaderProgram, 512, NULL, infoLog);
-    std::cerr << "ERROR::SHADER::PROGRAM::LINK_FAILED\n" << infoLog << std::endl;
-  }
-  glDeleteShader(vertexShader);
-  glDeleteShader(fragmentShader);
+  // The 330 shaders set their attribute locations themselves
+  std::vector<const char *> attributes;
+  if (glslVersion != "330") attributes = {"aPos", "aColor"};
+  state.shaderProgram = programs.program(vertexShaderSource, fragmentShaderSource, attributes);
 
   GL_CHECK();
   glUseProgram(state.shaderProgram);
+  state.tileTransformLocation = glGetUniformLocation(state.shaderProgram, "tileTransform");
+  glUniform4f(state.tileTransformLocation, 1.0f, 1.0f, 0.0f, 0.0f);
   GL_CHECK(glGenVertexArrays(1, &state.vao));
   GL_CHECK(glBindVertexArray(state.vao));
 
-  GLuint vbo;
-  glGenBuffers(1, &vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glGenBuffers(1, &state.vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, state.vbo);
   glBufferData(GL_ARRAY_BUFFER, sizeof(colorWheelVertices), colorWheelVertices, GL_STATIC_DRAW);
   GL_CHECK();
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
@@ -255,96 +281,55 @@ void setupColorWheel(MyState &state, const std::string &glslVersion) {
   GL_CHECK();
   glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
   glEnableVertexAttribArray(1);
+  state.hasColor = true;
 
-  GLuint ebo;
-  glGenBuffers(1, &ebo);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+  glGenBuffers(1, &state.ebo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, state.ebo);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(colorWheelIndices), colorWheelIndices, GL_STATIC_DRAW);
   GL_CHECK();
   state.numTris = sizeof(colorWheelIndices);
 }
 
-void setupCenter(MyState &state, const std::string &glslVersion) {
+void setupCenter(MyState &state, const std::string &glslVersion, ProgramRegistry &programs) {
   const char *vertexShaderSource;
-  if (glslVersion == "330") {
-    vertexShaderSource = default_vert_330;
-  } else if (glslVersion == "140") {
-    vertexShaderSource = default_vert_140;
-  } else if (glslVersion == "300 es") {
-    vertexShaderSource = default_vert_300_es;
-  } else if (glslVersion == "100 es") {
-    vertexShaderSource = default_vert_100_es;
-  } else {
-    std::cerr << "GLSL " << glslVersion << " shaders not implemented" << std::endl;
-    return;
-  }
-  GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-  glCompileShader(vertexShader);
-  GLint success;
-  char infoLog[512];
-  glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-  if (success != GL_TRUE) {
-    glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-    std::cerr << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-  }
-
   const char *fragmentShaderSource;
   if (glslVersion == "330") {
+    vertexShaderSource = default_vert_330;
     fragmentShaderSource = default_frag_330;
   } else if (glslVersion == "140") {
+    vertexShaderSource = default_vert_140;
     fragmentShaderSource = default_frag_140;
   } else if (glslVersion == "300 es") {
+    vertexShaderSource = default_vert_300_es;
     fragmentShaderSource = default_frag_300_es;
   } else if (glslVersion == "100 es") {
+    vertexShaderSource = default_vert_100_es;
     fragmentShaderSource = default_frag_100_es;
   } else {
     std::cerr << "GLSL " << glslVersion << " shaders not implemented" << std::endl;
     return;
   }
-  GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-  glCompileShader(fragmentShader);
-  glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-  if (success != GL_TRUE) {
-    glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-    std::cerr << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-  }
-
-  state.shaderProgram = glCreateProgram();
-  glAttachShader(state.shaderProgram, vertexShader);
-  glAttachShader(state.shaderProgram, fragmentShader);
-  GL_CHECK();
-  if (glslVersion != "330") {
-    glBindAttribLocation(state.shaderProgram, 0, "aPos");
-    glBindAttribLocation(state.shaderProgram, 1, "aColor");
-  }
-  GL_CHECK();
-  glLinkProgram(state.shaderProgram);
-  glGetProgramiv(state.shaderProgram, GL_LINK_STATUS, &success);
-  if (success != GL_TRUE) {
-    glGetProgramInfoLog(state.shaderProgram, 512, NULL, infoLog);
-    std::cerr << "ERROR::SHADER::PROGRAM::LINK_FAILED\n" << infoLog << std::endl;
-  }
-  glDeleteShader(vertexShader);
-  glDeleteShader(fragmentShader);
+  // The 330 shaders set their attribute locations themselves
+  std::vector<const char *> attributes;
+  if (glslVersion != "330") attributes = {"aPos", "aColor"};
+  state.shaderProgram = programs.program(vertexShaderSource, fragmentShaderSource, attributes);
 
   GL_CHECK();
   glUseProgram(state.shaderProgram);
+  state.tileTransformLocation = glGetUniformLocation(state.shaderProgram, "tileTransform");
+  glUniform4f(state.tileTransformLocation, 1.0f, 1.0f, 0.0f, 0.0f);
   GL_CHECK(glGenVertexArrays(1, &state.vao));
   GL_CHECK(glBindVertexArray(state.vao));
 
-  GLuint vbo;
-  glGenBuffers(1, &vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glGenBuffers(1, &state.vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, state.vbo);
   glBufferData(GL_ARRAY_BUFFER, sizeof(centerVertices), centerVertices, GL_STATIC_DRAW);
   GL_CHECK();
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
   glEnableVertexAttribArray(0);
 
-  GLuint ebo;
-  glGenBuffers(1, &ebo);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+  glGenBuffers(1, &state.ebo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, state.ebo);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(centerIndices), centerIndices, GL_STATIC_DRAW);
   GL_CHECK();
   state.numTris = sizeof(colorWheelIndices);
@@ -352,20 +337,122 @@ void setupCenter(MyState &state, const std::string &glslVersion) {
 
 } // namespace
 
-void setupModernOGL3(std::vector<MyState> &states, const std::string &glslVersion) {
+void setupModernOGL3(std::vector<MyState> &states, const std::string &glslVersion, ProgramRegistry &programs) {
   std::cout << "Rendering using modern OpenGL 3+" << std::endl;
   std::cout << "Using GLSL " << glslVersion << std::endl;
   states.emplace_back();
-  setupColorWheel(states.back(), glslVersion);
+  setupColorWheel(states.back(), glslVersion, programs);
   states.emplace_back();
-  setupCenter(states.back(), glslVersion);
+  setupCenter(states.back(), glslVersion, programs);
+}
+
+std::vector<MyState> shareModernOGL3(const std::vector<MyState> &states) {
+  auto shared = states;
+  for (auto& state : shared) {
+    GL_CHECK(glGenVertexArrays(1, &state.vao));
+    GL_CHECK(glBindVertexArray(state.vao));
+    glBindBuffer(GL_ARRAY_BUFFER, state.vbo);
+    const GLsizei stride = (state.hasColor ? 6 : 3) * sizeof(float);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+    glEnableVertexAttribArray(0);
+    if (state.hasColor) {
+      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
+      glEnableVertexAttribArray(1);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, state.ebo);
+    GL_CHECK();
+  }
+  return shared;
+}
+
+bool setupYUV420Pass(YUV420PassState &state, const std::string &glslVersion, int width, int height) {
+  if (width % 4 != 0 || height % 2 != 0) {
+    std::cerr << "GPU YUV conversion requires width divisible by 4 and even height" << std::endl;
+    return false;
+  }
+  std::string header;
+  std::string fragHeader;
+  if (glslVersion == "330") {
+    header = "#version 330 core\n";
+    fragHeader = "out vec4 FragColor;\n";
+  } else if (glslVersion == "140") {
+    header = "#version 140\n";
+    fragHeader = "out vec4 FragColor;\n";
+  } else if (glslVersion == "300 es") {
+    header = "#version 300 es\n";
+    fragHeader = "precision highp float;\nprecision highp int;\nout vec4 FragColor;\n";
+  } else {
+    std::cerr << "GPU YUV conversion not implemented for GLSL " << glslVersion << std::endl;
+    return false;
+  }
+  const std::string vertexSource = header + fullscreen_vert_body;
+  const std::string fragmentSource = header + fragHeader + yuv420_frag_body;
+  state.shaderProgram = linkProgram(vertexSource.c_str(), fragmentSource.c_str());
+  if (!state.shaderProgram) return false;
+
+  state.width = width;
+  state.height = height;
+  GL_CHECK(glUseProgram(state.shaderProgram));
+  GL_CHECK(glUniform1i(glGetUniformLocation(state.shaderProgram, "source"), 0));
+  GL_CHECK(glUniform2i(glGetUniformLocation(state.shaderProgram, "size"), width, height));
+  GL_CHECK(glGenVertexArrays(1, &state.vao));
+
+  GL_CHECK(glGenTextures(1, &state.sourceTexture));
+  GL_CHECK(glBindTexture(GL_TEXTURE_2D, state.sourceTexture));
+  GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+  GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+  GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr));
+
+  GLint drawFbo;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFbo);
+  GL_CHECK(glGenFramebuffers(1, &state.fbo));
+  GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, state.fbo));
+  GL_CHECK(glGenRenderbuffers(1, &state.renderbuffer));
+  GL_CHECK(glBindRenderbuffer(GL_RENDERBUFFER, state.renderbuffer));
+  GL_CHECK(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, state.targetWidth(), state.targetHeight()));
+  GL_CHECK(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, state.renderbuffer));
+  const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  GL_CHECK(glBindFramebuffer(GL_FRAMEBUFFER, drawFbo));
+  if (!complete) {
+    std::cerr << "YUV framebuffer incomplete" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void renderYUV420Pass(const YUV420PassState &state) {
+  GLint drawFbo;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFbo);
+  GL_CHECK(glBindFramebuffer(GL_READ_FRAMEBUFFER, drawFbo));
+  GL_CHECK(glActiveTexture(GL_TEXTURE0));
+  GL_CHECK(glBindTexture(GL_TEXTURE_2D, state.sourceTexture));
+  GL_CHECK(glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, state.width, state.height));
+
+  GL_CHECK(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, state.fbo));
+  GL_CHECK(glViewport(0, 0, state.targetWidth(), state.targetHeight()));
+  GL_CHECK(glUseProgram(state.shaderProgram));
+  GL_CHECK(glBindVertexArray(state.vao));
+  GL_CHECK(glDrawArrays(GL_TRIANGLES, 0, 3));
+
+  GL_CHECK(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFbo));
+  GL_CHECK(glBindFramebuffer(GL_READ_FRAMEBUFFER, state.fbo));
+  GL_CHECK(glViewport(0, 0, state.width, state.height));
 }
 
 void renderModernOGL3(const std::vector<MyState>& states) {
   GL_CHECK(glClearColor(0.4 + 0.6*std::rand()/RAND_MAX, 0.4 + 0.6*std::rand()/RAND_MAX, 0.4 + 0.6*std::rand()/RAND_MAX, 1.0));
-  GL_CHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+  {
+    GpuPass pass("Clear");
+    GL_CHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+  }
+  GpuPass pass("Draw");
+  const MyState *previous = nullptr;
   for (const auto& state : states) {
-    GL_CHECK(glUseProgram(state.shaderProgram));
+    // Consecutive states sharing a program are drawn without switching
+    if (!previous || previous->shaderProgram != state.shaderProgram) {
+      GL_CHECK(glUseProgram(state.shaderProgram));
+    }
+    previous = &state;
     GL_CHECK(glBindVertexArray(state.vao));
     GL_CHECK(glDrawElements(GL_TRIANGLES, state.numTris * 3, GL_UNSIGNED_BYTE, 0));
   }
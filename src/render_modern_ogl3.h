@@ -2,7 +2,18 @@
 
 #include <vector>
 
+#include "ProgramRegistry.h"
 #include "state.h"
 
-void setupModernOGL3(std::vector<MyState> &state, const std::string &glslVersion);
+// Scene objects with the same shaders share a program from programs
+void setupModernOGL3(std::vector<MyState> &state, const std::string &glslVersion, ProgramRegistry &programs);
 void renderModernOGL3(const std::vector<MyState>& states);
+// Vertex arrays aren't shared between contexts: creates them for the current context,
+// which must share programs and buffers with the one states were set up in
+std::vector<MyState> shareModernOGL3(const std::vector<MyState> &states);
+
+// Sets up a pass converting the framebuffer to planar I420 (BT.601, limited range, top row first).
+// Requires width divisible by 4 and even height. Returns false if unsupported.
+bool setupYUV420Pass(YUV420PassState &state, const std::string &glslVersion, int width, int height);
+// Converts the current draw framebuffer. Leaves the I420 target bound for reading.
+void renderYUV420Pass(const YUV420PassState &state);
@@ -0,0 +1,218 @@
+#include "shader_cache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <random>
+
+#include "phase_timings.h"
+
+namespace {
+
+std::filesystem::path cacheDirectory;
+
+struct CacheHeader {
+  char magic[8];
+  uint32_t binaryFormat;
+  uint32_t keySize;
+  uint32_t binarySize;
+};
+
+const char cacheMagic[8] = {'O', 'F', 'F', 'S', 'P', 'R', 'G', '1'};
+
+// FNV-1a, stable across builds unlike hashFrame()
+uint64_t hashKey(const std::string& key)
+{
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (unsigned char c : key) {
+    hash = (hash ^ c) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+std::string glString(GLenum name)
+{
+  const auto *value = reinterpret_cast<const char *>(glGetString(name));
+  return value ? value : "";
+}
+
+bool programBinariesSupported()
+{
+#ifdef USE_GLAD
+  // Loaded for OpenGL 4.1, GL_ARB_get_program_binary, GLES 3 and GL_OES_get_program_binary
+  if (!glGetProgramBinary || !glProgramBinary) return false;
+  // Mesa only has a format while its own shader cache is enabled
+  GLint numFormats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+  return numFormats > 0;
+#else
+  return false;
+#endif
+}
+
+// Returns 0 if the file is missing, stale or rejected by the driver
+GLuint loadProgram(const std::filesystem::path& path, const std::string& key)
+{
+#ifdef USE_GLAD
+  FILE *f = fopen(path.string().c_str(), "rb");
+  if (!f) return 0;
+  PhaseTimer timer("Shader cache load");
+  CacheHeader header;
+  std::string storedKey;
+  std::vector<char> binary;
+  bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+    std::equal(std::begin(cacheMagic), std::end(cacheMagic), header.magic) && header.keySize == key.size();
+  if (ok) {
+    storedKey.resize(header.keySize);
+    binary.resize(header.binarySize);
+    ok = fread(storedKey.data(), 1, storedKey.size(), f) == storedKey.size() &&
+      fread(binary.data(), 1, binary.size(), f) == binary.size() && storedKey == key;
+  }
+  fclose(f);
+  if (!ok) return 0;
+
+  GLuint program = glCreateProgram();
+  glProgramBinary(program, header.binaryFormat, binary.data(), binary.size());
+  GLint success = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (success != GL_TRUE) {
+    // An unknown format is an error rather than a failed link
+    while (glGetError() != GL_NO_ERROR) {}
+    glDeleteProgram(program);
+    std::cout << "Cached program binary rejected, compiling" << std::endl;
+    return 0;
+  }
+  return program;
+#else
+  return 0;
+#endif
+}
+
+void saveProgram(const std::filesystem::path& path, const std::string& key, GLuint program)
+{
+#ifdef USE_GLAD
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) return;
+  std::vector<char> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(program, length, &length, &format, binary.data());
+  if (length <= 0) return;
+
+  std::error_code error;
+  std::filesystem::create_directories(path.parent_path(), error);
+  // Written under a temporary name and renamed, so concurrent processes never read half a file
+  auto tempPath = path;
+  tempPath += ".tmp" + std::to_string(std::random_device{}());
+  FILE *f = fopen(tempPath.string().c_str(), "wb");
+  if (!f) {
+    std::cerr << "Unable to write shader cache file " << tempPath.string() << std::endl;
+    return;
+  }
+  CacheHeader header = {{}, format, static_cast<uint32_t>(key.size()), static_cast<uint32_t>(length)};
+  std::copy(std::begin(cacheMagic), std::end(cacheMagic), header.magic);
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(key.data(), 1, key.size(), f) == key.size() &&
+    fwrite(binary.data(), 1, length, f) == static_cast<size_t>(length);
+  ok = (fclose(f) == 0) && ok;
+  if (ok) std::filesystem::rename(tempPath, path, error);
+  if (!ok || error) {
+    std::cerr << "Unable to write shader cache file " << path.string() << std::endl;
+    std::filesystem::remove(tempPath, error);
+  }
+#endif
+}
+
+// Without deleteShaders, the shaders belong to whoever compile got them from
+GLuint createProgram(const char *vertexSource, const char *fragmentSource, const std::vector<const char *>& attributes,
+                     const std::function<GLuint(GLenum, const char *)>& compile, bool deleteShaders)
+{
+  const bool useCache = !cacheDirectory.empty() && programBinariesSupported();
+  std::string key;
+  std::filesystem::path path;
+  if (useCache) {
+    key = glString(GL_VENDOR) + "\n" + glString(GL_RENDERER) + "\n" + glString(GL_VERSION) + "\n";
+    for (const char *attribute : attributes) key += std::string(attribute ? attribute : "") + ",";
+    key += "\n" + std::string(vertexSource) + '\0' + fragmentSource;
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(hashKey(key)));
+    path = cacheDirectory / name;
+    if (GLuint program = loadProgram(path, key)) return program;
+  }
+
+  PhaseTimer timer("Shader compile and link");
+  const GLuint vertexShader = compile(GL_VERTEX_SHADER, vertexSource);
+  const GLuint fragmentShader = compile(GL_FRAGMENT_SHADER, fragmentSource);
+  if (!vertexShader || !fragmentShader) {
+    if (deleteShaders && vertexShader) glDeleteShader(vertexShader);
+    if (deleteShaders && fragmentShader) glDeleteShader(fragmentShader);
+    return 0;
+  }
+  GLuint program = glCreateProgram();
+  glAttachShader(program, vertexShader);
+  glAttachShader(program, fragmentShader);
+  for (size_t i = 0; i < attributes.size(); i++) {
+    if (attributes[i]) glBindAttribLocation(program, i, attributes[i]);
+  }
+#ifdef USE_GLAD
+  // Not part of GL_OES_get_program_binary
+  if (useCache && glProgramParameteri) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+#endif
+  GL_CHECK();
+  glLinkProgram(program);
+  if (deleteShaders) {
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+  }
+  GLint success;
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (success != GL_TRUE) {
+    char infoLog[512];
+    glGetProgramInfoLog(program, 512, NULL, infoLog);
+    std::cerr << "ERROR::SHADER::PROGRAM::LINK_FAILED\n" << infoLog << std::endl;
+    glDeleteProgram(program);
+    return 0;
+  }
+  timer.stop();
+
+  if (useCache) saveProgram(path, key, program);
+  return program;
+}
+
+}  // namespace
+
+void setShaderCacheDirectory(const std::string& directory)
+{
+  cacheDirectory = directory;
+}
+
+GLuint compileShader(GLenum type, const char *source)
+{
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, NULL);
+  glCompileShader(shader);
+  GLint success;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+  if (success != GL_TRUE) {
+    char infoLog[512];
+    glGetShaderInfoLog(shader, 512, NULL, infoLog);
+    std::cerr << "ERROR::SHADER::" << (type == GL_VERTEX_SHADER ? "VERTEX" : "FRAGMENT")
+              << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+GLuint linkProgram(const char *vertexSource, const char *fragmentSource, const std::vector<const char *>& attributes)
+{
+  return createProgram(vertexSource, fragmentSource, attributes, compileShader, /*deleteShaders*/ true);
+}
+
+GLuint linkProgram(const char *vertexSource, const char *fragmentSource, const std::vector<const char *>& attributes,
+                   const std::function<GLuint(GLenum, const char *)>& compile)
+{
+  return createProgram(vertexSource, fragmentSource, attributes, compile, /*deleteShaders*/ false);
+}
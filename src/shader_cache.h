@@ -0,0 +1,27 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "system-gl.h"
+
+// Program binary cache, see --shader-cache.
+// Linked programs are saved with glGetProgramBinary() under a key made of their sources, attribute
+// bindings, GL_VENDOR, GL_RENDERER and GL_VERSION, so driver updates and source changes miss.
+
+// Sets the directory program binaries are kept in, created when first written. Empty disables the cache.
+void setShaderCacheDirectory(const std::string& directory);
+
+// Creates a program from vertex and fragment shader sources, binding attributes[i] to location i
+// (nullptr entries are skipped). Loads the program from the cache if the driver accepts the binary,
+// otherwise compiles and links it and adds it to the cache. Returns 0 on failure.
+GLuint linkProgram(const char *vertexSource, const char *fragmentSource,
+                   const std::vector<const char *>& attributes = {});
+// Like linkProgram() above, but gets its shaders from compile and leaves deleting them to the caller,
+// so they can be reused between programs (see ProgramRegistry)
+GLuint linkProgram(const char *vertexSource, const char *fragmentSource, const std::vector<const char *>& attributes,
+                   const std::function<GLuint(GLenum, const char *)>& compile);
+
+// Compiles a shader, printing the log if that fails. Returns 0 on failure.
+GLuint compileShader(GLenum type, const char *source);
@@ -3,7 +3,26 @@
 #include "system-gl.h"
 
 struct MyState {
-  GLuint shaderProgram;
+  GLuint shaderProgram;  // Shared by states with the same shaders, see ProgramRegistry
   GLuint vao;
   int numTris;
+  GLint tileTransformLocation = -1;  // See applyTileTransform()
+  // Buffers the vertex array points at, for recreating it in contexts sharing them (see shareModernOGL3())
+  GLuint vbo = 0;
+  GLuint ebo = 0;
+  bool hasColor = false;  // Interleaved position and color
+};
+
+// GPU RGBA -> I420 conversion, see setupYUV420Pass()
+struct YUV420PassState {
+  GLuint shaderProgram = 0;
+  GLuint vao = 0;
+  GLuint sourceTexture = 0;
+  GLuint fbo = 0;
+  GLuint renderbuffer = 0;
+  int width = 0;  // Source size
+  int height = 0;
+  // The I420 planes are packed four bytes per RGBA pixel into a target of this size
+  int targetWidth() const { return width / 4; }
+  int targetHeight() const { return height * 3 / 2; }
 };
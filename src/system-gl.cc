@@ -1,3 +1,7 @@
+#ifdef USE_GLAD
+#define GLAD_GL_IMPLEMENTATION
+#define GLAD_EGL_IMPLEMENTATION
+#endif
 #include "system-gl.h"
 
 #include <set>
@@ -0,0 +1,36 @@
+#include "tiled_render.h"
+
+#include "system-gl.h"
+
+TileTransform tileTransform(const PixelRect& tile, int width, int height)
+{
+  // Clip space [-1, 1] spans the full image, the tile covers [2 * x / width - 1, 2 * (x + w) / width - 1]
+  TileTransform transform;
+  transform.scaleX = static_cast<float>(width) / tile.width;
+  transform.scaleY = static_cast<float>(height) / tile.height;
+  transform.offsetX = static_cast<float>(width - 2 * tile.x - tile.width) / tile.width;
+  transform.offsetY = static_cast<float>(height - 2 * tile.y - tile.height) / tile.height;
+  return transform;
+}
+
+void applyTileTransform(const std::vector<MyState>& states, const TileTransform& transform)
+{
+  const MyState *previous = nullptr;
+  for (const auto& state : states) {
+    // The uniform is program state, so set it once per shared program
+    if (previous && previous->shaderProgram == state.shaderProgram) continue;
+    previous = &state;
+    GL_CHECK(glUseProgram(state.shaderProgram));
+    GL_CHECK(glUniform4f(state.tileTransformLocation, transform.scaleX, transform.scaleY,
+                         transform.offsetX, transform.offsetY));
+  }
+}
+
+void applyTileTransformImmediate(const TileTransform& transform)
+{
+  GL_CHECK(glMatrixMode(GL_PROJECTION));
+  GL_CHECK(glLoadIdentity());
+  GL_CHECK(glTranslatef(transform.offsetX, transform.offsetY, 0.0f));
+  GL_CHECK(glScalef(transform.scaleX, transform.scaleY, 1.0f));
+  GL_CHECK(glMatrixMode(GL_MODELVIEW));
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <vector>
+
+#include "PixelBuffer.h"
+#include "state.h"
+
+// Scale and offset mapping the part of clip space covered by a tile onto the whole viewport,
+// so a scene can be rendered tile by tile without changing it
+struct TileTransform {
+  float scaleX = 1.0f;
+  float scaleY = 1.0f;
+  float offsetX = 0.0f;
+  float offsetY = 0.0f;
+};
+
+// tile is in OpenGL window coordinates of the full width x height image
+TileTransform tileTransform(const PixelRect& tile, int width, int height);
+// Sets the tileTransform uniform of the programs in states
+void applyTileTransform(const std::vector<MyState>& states, const TileTransform& transform);
+// Loads the transform into the fixed-function projection matrix
+void applyTileTransformImmediate(const TileTransform& transform);
@@ -0,0 +1,143 @@
+// Checks the pixel conversion kernels of every instruction set this CPU supports against the scalar
+// ones, out of place and in place, for pixel counts on both sides of each vector width.
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "pixel_convert.h"
+
+namespace {
+
+struct Kernel {
+  const char *name;
+  void (*convert)(const uint8_t *, uint8_t *, size_t);
+  size_t dstBytesPerPixel;
+};
+
+const Kernel kernels[] = {
+  {"swizzleRB", swizzleRB, 4},
+  {"rgbaToRGB", rgbaToRGB, 3},
+  {"premultiplyAlpha", premultiplyAlpha, 4},
+  {"unpremultiplyAlpha", unpremultiplyAlpha, 4},
+};
+
+// Written after the output, where no kernel may store
+constexpr size_t guardBytes = 64;
+constexpr uint8_t guardValue = 0xcd;
+
+// Every (color, alpha) pair in each color channel, with the channels differing so swaps show
+std::vector<uint8_t> allColorAlphaPairs()
+{
+  std::vector<uint8_t> pixels(4 * 256 * 256);
+  for (size_t i = 0; i < 256 * 256; ++i) {
+    const uint8_t color = i & 0xff;
+    pixels[4 * i + 0] = color;
+    pixels[4 * i + 1] = 255 - color;
+    pixels[4 * i + 2] = color ^ 0x5a;
+    pixels[4 * i + 3] = i >> 8;
+  }
+  return pixels;
+}
+
+// Returns the converted pixels followed by the guard bytes
+std::vector<uint8_t> convert(const Kernel& kernel, const uint8_t *src, size_t numPixels, bool inPlace)
+{
+  std::vector<uint8_t> out;
+  if (inPlace) {
+    out.assign(src, src + 4 * numPixels);
+    out.resize(out.size() + guardBytes, guardValue);
+    kernel.convert(out.data(), out.data(), numPixels);
+    // What rgbaToRGB() leaves behind its output is unspecified
+    out.erase(out.begin() + kernel.dstBytesPerPixel * numPixels, out.begin() + 4 * numPixels);
+  } else {
+    out.assign(kernel.dstBytesPerPixel * numPixels + guardBytes, guardValue);
+    kernel.convert(src, out.data(), numPixels);
+  }
+  return out;
+}
+
+bool checkKernel(PixelISA isa, const Kernel& kernel, const uint8_t *src, size_t numPixels, bool inPlace)
+{
+  setPixelISA(PixelISA::Scalar);
+  const auto expected = convert(kernel, src, numPixels, inPlace);
+  setPixelISA(isa);
+  const auto actual = convert(kernel, src, numPixels, inPlace);
+  if (actual == expected) return true;
+
+  size_t i = 0;
+  while (actual[i] == expected[i]) ++i;
+  const size_t outputSize = kernel.dstBytesPerPixel * numPixels;
+  std::cerr << pixelISAName(isa) << " " << kernel.name << (inPlace ? " in place" : "") << ", " << numPixels
+            << " pixels: ";
+  if (i >= outputSize) {
+    std::cerr << "overwrote byte " << i - outputSize << " past the output" << std::endl;
+  } else {
+    const size_t pixel = i / kernel.dstBytesPerPixel;
+    std::cerr << "pixel " << pixel << " (" << +src[4 * pixel] << ", " << +src[4 * pixel + 1] << ", "
+              << +src[4 * pixel + 2] << ", " << +src[4 * pixel + 3] << ") byte " << i % kernel.dstBytesPerPixel
+              << " is " << +actual[i] << ", expected " << +expected[i] << std::endl;
+  }
+  return false;
+}
+
+bool checkFlipRows(PixelISA isa, const uint8_t *src, size_t rowBytes, size_t numRows)
+{
+  std::vector<uint8_t> expected(rowBytes * numRows);
+  for (size_t row = 0; row < numRows; ++row) {
+    memcpy(expected.data() + row * rowBytes, src + (numRows - 1 - row) * rowBytes, rowBytes);
+  }
+  setPixelISA(isa);
+  std::vector<uint8_t> actual(src, src + rowBytes * numRows);
+  flipRows(actual.data(), rowBytes, numRows);
+  if (actual == expected) return true;
+  std::cerr << pixelISAName(isa) << " flipRows, " << numRows << " rows of " << rowBytes << " bytes differ"
+            << std::endl;
+  return false;
+}
+
+} // namespace
+
+int main()
+{
+  const auto pixels = allColorAlphaPairs();
+  const size_t numPairs = pixels.size() / 4;
+  // Up to and past five AVX2 vectors, which covers the tails of every kernel, including rgbaToRGB's
+  // which has to stop early so its 32-byte stores stay within the output
+  std::vector<size_t> counts;
+  for (size_t count = 0; count <= 41; ++count) counts.push_back(count);
+  for (size_t count : {63, 64, 65, 255, 256, 257, 1001}) counts.push_back(count);
+
+  size_t numChecks = 0;
+  size_t numFailures = 0;
+  const auto check = [&](bool passed) {
+    numChecks++;
+    if (!passed) numFailures++;
+  };
+  for (const auto isa : supportedPixelISAs()) {
+    std::cout << "Checking " << pixelISAName(isa) << " kernels" << std::endl;
+    for (const auto& kernel : kernels) {
+      for (bool inPlace : {false, true}) {
+        check(checkKernel(isa, kernel, pixels.data(), numPairs, inPlace));
+        check(checkKernel(isa, kernel, pixels.data(), numPairs - 1, inPlace));
+        // Short runs starting at transparent, half transparent and opaque pixels
+        for (size_t first : {size_t{0}, numPairs / 2 + 3, numPairs - 1001}) {
+          for (size_t count : counts) {
+            check(checkKernel(isa, kernel, pixels.data() + 4 * first, count, inPlace));
+          }
+        }
+      }
+    }
+    for (size_t rowBytes : {1, 3, 4, 31, 32, 33, 63, 64, 65, 1000}) {
+      for (size_t numRows : {0, 1, 2, 3, 4, 7}) check(checkFlipRows(isa, pixels.data(), rowBytes, numRows));
+    }
+  }
+
+  if (numFailures > 0) {
+    std::cerr << numFailures << " of " << numChecks << " checks failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All " << numChecks << " checks passed" << std::endl;
+  return 0;
+}